@@ -0,0 +1,228 @@
+#include "affinity.h"
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+CpuAffinity* CpuAffinity::affinityptr = new CpuAffinity;
+
+CpuAffinity::CpuAffinity() : isOpen_(false), steering_(false), reactorCpu_(-1) {}
+
+CpuAffinity* CpuAffinity::Instance() {
+    return affinityptr;
+}
+
+vector<int> CpuAffinity::ParseList(const string& list) {
+    vector<int> cpus;
+    size_t pos = 0;
+    while(pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if(end == string::npos) {
+            end = list.size();
+        }
+        string item = list.substr(pos, end - pos);
+        pos = end + 1;
+        int first, last;
+        if(sscanf(item.c_str(), "%d-%d", &first, &last) == 2) {
+            for(int i = first; i <= last; ++i) {
+                cpus.push_back(i);
+            }
+        } else if(sscanf(item.c_str(), "%d", &first) == 1) {
+            cpus.push_back(first);
+        }
+    }
+    return cpus;
+}
+
+void CpuAffinity::LoadNodes_() {
+    cpuNode_.clear();
+    DIR* dp = opendir("/sys/devices/system/node");
+    if(!dp) {
+        return;
+    }
+    struct dirent* ent;
+    while((ent = readdir(dp)) != nullptr) {
+        int node;
+        if(sscanf(ent->d_name, "node%d", &node) != 1) {
+            continue;
+        }
+        string path = string("/sys/devices/system/node/") + ent->d_name + "/cpulist";
+        FILE* fp = fopen(path.c_str(), "r");
+        if(!fp) {
+            continue;
+        }
+        char buf[1024] = {0};
+        if(fgets(buf, sizeof(buf), fp)) {
+            for(int cpu : ParseList(buf)) {
+                cpuNode_[cpu] = node;
+            }
+        }
+        fclose(fp);
+    }
+    closedir(dp);
+}
+
+int CpuAffinity::NodeOf_(int cpu) const {
+    unordered_map<int, int>::const_iterator it = cpuNode_.find(cpu);
+    return it == cpuNode_.end() ? 0 : it->second;
+}
+
+void CpuAffinity::Init(bool enable, const string& reactorCpu, const string& workerCpus,
+                       const string& logCpus, int workerNum) {
+    isOpen_ = false;
+    steering_ = false;
+    if(!enable) {
+        return;
+    }
+    //容器里可能只让用一部分CPU，只在允许的CPU里分配
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) < 0) {
+        return;
+    }
+    vector<int> allowed;
+    for(int i = 0; i < CPU_SETSIZE; ++i) {
+        if(CPU_ISSET(i, &set)) {
+            allowed.push_back(i);
+        }
+    }
+    if(allowed.empty()) {
+        return;
+    }
+    LoadNodes_();
+
+    vector<int> reactor = ParseList(reactorCpu);
+    reactorCpu_ = reactor.empty() ? allowed[0] : reactor[0];
+    int home = NodeOf_(reactorCpu_);
+
+    workerCpus_ = ParseList(workerCpus);
+    if(workerCpus_.empty()) {
+        //先用主线程所在节点的其余CPU，不够时再用别的节点，只有一个CPU时也只能和主线程挤在一起
+        for(int cpu : allowed) {
+            if(cpu != reactorCpu_ && NodeOf_(cpu) == home) {
+                workerCpus_.push_back(cpu);
+            }
+        }
+        if(static_cast<int>(workerCpus_.size()) < workerNum) {
+            for(int cpu : allowed) {
+                if(NodeOf_(cpu) != home) {
+                    workerCpus_.push_back(cpu);
+                }
+            }
+        }
+        if(workerCpus_.empty()) {
+            workerCpus_.push_back(reactorCpu_);
+        }
+    }
+
+    floatingCpus_.clear();
+    for(int cpu : allowed) {
+        if(cpu != reactorCpu_) {
+            floatingCpus_.push_back(cpu);
+        }
+    }
+    if(floatingCpus_.empty()) {
+        floatingCpus_.push_back(reactorCpu_);
+    }
+
+    logCpus_ = ParseList(logCpus);
+    if(logCpus_.empty()) {
+        //日志线程不忙，给它整个节点，由调度器找空闲的CPU
+        for(int cpu : allowed) {
+            if(NodeOf_(cpu) == home) {
+                logCpus_.push_back(cpu);
+            }
+        }
+    }
+
+    nodeWorkers_.clear();
+    nodeNext_.clear();
+    for(int i = 0; i < workerNum; ++i) {
+        nodeWorkers_[NodeOf_(workerCpus_[i % workerCpus_.size()])].push_back(i);
+    }
+    steering_ = nodeWorkers_.size() > 1;
+    isOpen_ = true;
+}
+
+bool CpuAffinity::Pin_(const vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus) {
+        if(cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void CpuAffinity::PinReactor() const {
+    if(isOpen_) {
+        Pin_(vector<int>(1, reactorCpu_));
+    }
+}
+
+void CpuAffinity::PinWorker(int index) const {
+    if(isOpen_ && index >= 0) {
+        Pin_(vector<int>(1, workerCpus_[index % workerCpus_.size()]));
+    }
+}
+
+void CpuAffinity::PinFloating() const {
+    if(isOpen_) {
+        Pin_(floatingCpus_);
+    }
+}
+
+void CpuAffinity::PinLog() const {
+    if(isOpen_) {
+        Pin_(logCpus_);
+    }
+}
+
+int CpuAffinity::IncomingCpu(int sockfd) const {
+    if(!steering_) {
+        return -1;
+    }
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if(getsockopt(sockfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) < 0) {
+        return -1;
+    }
+    return cpu;
+}
+
+int CpuAffinity::PickWorker(int cpu) {
+    if(!steering_ || cpu < 0) {
+        return -1;
+    }
+    int node = NodeOf_(cpu);
+    unordered_map<int, vector<int>>::iterator it = nodeWorkers_.find(node);
+    if(it == nodeWorkers_.end()) {
+        return -1;//这个节点上没有工作线程，按原来的轮询
+    }
+    size_t& next = nodeNext_[node];
+    int worker = it->second[next % it->second.size()];
+    ++next;
+    return worker;
+}
+
+string CpuAffinity::Describe() const {
+    if(!isOpen_) {
+        return "off";
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "reactor %d, workers", reactorCpu_);
+    string desc = buf;
+    for(int cpu : workerCpus_) {
+        desc += " " + to_string(cpu);
+    }
+    desc += ", db/io " + to_string(floatingCpus_.size()) + " cpus";
+    desc += ", log";
+    for(int cpu : logCpus_) {
+        desc += " " + to_string(cpu);
+    }
+    desc += ", nodes " + to_string(nodeWorkers_.size());
+    return desc;
+}
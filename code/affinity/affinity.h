@@ -0,0 +1,66 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+//线程的CPU绑定和NUMA的放置
+//主线程(reactor)绑在一个CPU上，工作线程优先放在和它同一个NUMA节点的其余CPU上，日志线程可以用这个节点的任意CPU
+//连接对象、读写缓冲区都是主线程分配并先写的，按first-touch分在主线程的节点上，工作线程在同一个节点上处理就不用跨节点访问
+//工作线程跨了多个节点时，按accept后套接字的SO_INCOMING_CPU(网卡RSS把这个连接的包交给了哪个CPU)选同一节点上的工作线程
+//只有静态页面的线程池一个线程绑一个CPU；数据库和IO的线程池大多时间阻塞着，不绑单个CPU，
+//在除了主线程以外所有允许的CPU上由调度器安排，不会和静态页面的线程按下标挤到同一个CPU上
+//Init要在创建日志线程和线程池之前调用，之后只读
+class CpuAffinity {
+public:
+    static CpuAffinity* Instance();
+
+    //enable为false时什么都不做；各个CPU列表形如"0-3,8"，空字符串表示自动分配
+    //workerNum是线程池的线程数，用来算每个节点上有哪些工作线程
+    void Init(bool enable, const std::string& reactorCpu, const std::string& workerCpus,
+              const std::string& logCpus, int workerNum);
+    bool IsOpen() const { return isOpen_; }
+
+    //绑定调用者所在的线程
+    void PinReactor() const;
+    void PinWorker(int index) const;
+    //数据库和IO线程池的线程调用，线程是主线程创建的，不设置的话会继承主线程绑的那个CPU
+    void PinFloating() const;
+    void PinLog() const;
+
+    //主线程accept后调用，取出这个连接的包是哪个CPU收的，不需要按它选线程时返回-1，不做系统调用
+    int IncomingCpu(int sockfd) const;
+    //按收包的CPU选同一节点上的工作线程，轮流分给这个节点的线程，返回-1表示不指定
+    //只在主线程调用
+    int PickWorker(int cpu);
+    //启动日志里记录的分配结果
+    std::string Describe() const;
+
+    static std::vector<int> ParseList(const std::string& list);
+
+private:
+    CpuAffinity();
+    ~CpuAffinity() = default;
+
+    static bool Pin_(const std::vector<int>& cpus);
+    int NodeOf_(int cpu) const;
+    void LoadNodes_();
+
+    bool isOpen_;
+    bool steering_;//工作线程分布在多个节点上时才按收包的CPU选线程
+    int reactorCpu_;
+    std::vector<int> workerCpus_;//第i个工作线程绑在workerCpus_[i % size]上
+    std::vector<int> logCpus_;
+    std::vector<int> floatingCpus_;//除了主线程以外所有允许的CPU
+    std::unordered_map<int, int> cpuNode_;//CPU所在的节点，取不到拓扑时都算节点0
+    std::unordered_map<int, std::vector<int>> nodeWorkers_;//每个节点上的工作线程下标
+    std::unordered_map<int, size_t> nodeNext_;//每个节点下一次轮到的工作线程
+    static CpuAffinity* affinityptr;
+};
+
+#endif //AFFINITY_H
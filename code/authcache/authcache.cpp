@@ -0,0 +1,126 @@
+#include "authcache.h"
+#include <random>
+
+using namespace std;
+
+//生成凭证缓存的单例
+AuthCache* AuthCache::authptr = new AuthCache;
+
+AuthCache::AuthCache() {
+    isOpen_ = false;
+    ttlMs_ = 0;
+    negativeTtlMs_ = 0;
+    maxShardEntries_ = 0;
+}
+
+AuthCache* AuthCache::Instance() {
+    return authptr;
+}
+
+void AuthCache::Init(int ttlMs, int negativeTtlMs, int maxEntries) {
+    ttlMs_ = ttlMs;
+    negativeTtlMs_ = negativeTtlMs;
+    maxShardEntries_ = maxEntries > SHARD_NUM ? maxEntries / SHARD_NUM : 1;
+    isOpen_ = ttlMs > 0;
+}
+
+AuthCache::Shard& AuthCache::GetShard_(const std::string& name) {
+    return shards_[hash<string>()(name) % SHARD_NUM];
+}
+
+void AuthCache::HashPassword_(const uint8_t* salt, const std::string& pwd, uint8_t* hash) {
+    Sha256 sha;
+    sha.Update(salt, SALT_LEN);
+    sha.Update(pwd.data(), pwd.size());
+    sha.Final(hash);
+}
+
+AuthCache::RESULT AuthCache::Check(const std::string& name, const std::string& pwd) {
+    if(!isOpen_) {
+        return MISS;
+    }
+    Shard& shard = GetShard_(name);
+    uint8_t salt[SALT_LEN];
+    uint8_t hash[Sha256::DIGEST_LEN];
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.nodes.find(name);
+        if(it == shard.nodes.end()) {
+            return MISS;
+        }
+        if(it->second.expires <= chrono::steady_clock::now()) {
+            shard.nodes.erase(it);
+            return MISS;
+        }
+        if(!it->second.exists) {
+            return NO_USER;
+        }
+        memcpy(salt, it->second.salt, SALT_LEN);
+        memcpy(hash, it->second.hash, Sha256::DIGEST_LEN);
+    }
+    //计算摘要比较耗时，放在锁外面做
+    uint8_t input[Sha256::DIGEST_LEN];
+    HashPassword_(salt, pwd, input);
+    //逐字节累计差异再判断，比较时间和密码对了多少位无关
+    uint8_t diff = 0;
+    for(int i = 0; i < Sha256::DIGEST_LEN; ++i) {
+        diff |= input[i] ^ hash[i];
+    }
+    return diff == 0 ? MATCH : MISMATCH;
+}
+
+void AuthCache::Put(const std::string& name, const std::string& pwd) {
+    if(!isOpen_) {
+        return;
+    }
+    //每个线程一个随机数引擎，盐只需要各不相同，不需要每次都读/dev/urandom
+    static thread_local mt19937_64 engine(random_device{}());
+    AuthNode node;
+    node.exists = true;
+    for(int i = 0; i < SALT_LEN; i += 8) {
+        uint64_t r = engine();
+        memcpy(node.salt + i, &r, 8);
+    }
+    HashPassword_(node.salt, pwd, node.hash);
+    Insert_(name, node, ttlMs_);
+}
+
+void AuthCache::PutNoUser(const std::string& name) {
+    if(!isOpen_ || negativeTtlMs_ <= 0) {
+        return;
+    }
+    AuthNode node;
+    node.exists = false;
+    Insert_(name, node, negativeTtlMs_);
+}
+
+void AuthCache::Invalidate(const std::string& name) {
+    if(!isOpen_) {
+        return;
+    }
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.nodes.erase(name);
+}
+
+void AuthCache::Insert_(const std::string& name, AuthNode& node, int ttlMs) {
+    auto now = chrono::steady_clock::now();
+    node.expires = now + chrono::milliseconds(ttlMs);
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.nodes.size() >= maxShardEntries_ && shard.nodes.count(name) == 0) {
+        //分片满了，先清理掉过期的结点
+        for(auto it = shard.nodes.begin(); it != shard.nodes.end();) {
+            if(it->second.expires <= now) {
+                it = shard.nodes.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        //还是满的就随便丢掉一个，缓存丢了只是多查一次数据库
+        if(shard.nodes.size() >= maxShardEntries_) {
+            shard.nodes.erase(shard.nodes.begin());
+        }
+    }
+    shard.nodes[name] = node;
+}
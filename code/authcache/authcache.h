@@ -0,0 +1,70 @@
+#ifndef AUTHCACHE_H
+#define AUTHCACHE_H
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "../sha256/sha256.h"
+#include "../log/log.h"
+
+//登陆凭证缓存，放在mysql前面，重复登陆不需要再访问数据库
+//只保存加盐后的密码摘要，不保存明文，不存在的用户也会缓存一小段时间（负缓存）
+//按用户名分成多个分片，每个分片一把锁，减少工作线程之间的竞争
+class AuthCache {
+public:
+    //查询缓存的结果
+    //MISS:缓存中没有或已过期，需要查数据库  MATCH:用户存在且密码正确
+    //MISMATCH:用户存在但密码错误  NO_USER:缓存中记录了该用户不存在
+    enum RESULT { MISS = 0, MATCH, MISMATCH, NO_USER };
+
+    static AuthCache* Instance();
+
+    //ttlMs是存在的用户的缓存时间，negativeTtlMs是不存在的用户的缓存时间，maxEntries是缓存的最大条目数，ttlMs<=0表示关闭缓存
+    void Init(int ttlMs, int negativeTtlMs, int maxEntries);
+    //用用户名和密码查询缓存
+    RESULT Check(const std::string& name, const std::string& pwd);
+    //数据库查到了用户，保存用户的密码摘要
+    void Put(const std::string& name, const std::string& pwd);
+    //数据库中没有这个用户，做一个负缓存
+    void PutNoUser(const std::string& name);
+    //用户信息发生变化（比如注册插入了新用户）时，让缓存失效
+    void Invalidate(const std::string& name);
+
+private:
+    AuthCache();
+    ~AuthCache() = default;
+
+    static const int SHARD_NUM = 16;//分片数量
+    static const int SALT_LEN = 16;//盐的长度
+
+    struct AuthNode {
+        bool exists;//用户是否存在
+        uint8_t salt[SALT_LEN];
+        uint8_t hash[Sha256::DIGEST_LEN];//sha256(salt + 密码)
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, AuthNode> nodes;
+    };
+
+    Shard& GetShard_(const std::string& name);
+    //往分片里放一个结点，分片满了会先清理过期的结点
+    void Insert_(const std::string& name, AuthNode& node, int ttlMs);
+    static void HashPassword_(const uint8_t* salt, const std::string& pwd, uint8_t* hash);
+
+    bool isOpen_;
+    int ttlMs_;
+    int negativeTtlMs_;
+    size_t maxShardEntries_;//每个分片的最大条目数
+    Shard shards_[SHARD_NUM];
+
+private:
+    static AuthCache* authptr;
+};
+
+#endif //AUTHCACHE_H
@@ -0,0 +1,212 @@
+#include "blobstore.h"
+
+using namespace std;
+
+BlobStore* BlobStore::storeptr = new BlobStore;
+
+BlobStore::BlobStore() : dedup_(false), tempSeq_(0) {}
+
+BlobStore* BlobStore::Instance() {
+    return storeptr;
+}
+
+bool BlobStore::Init(const string& dir, bool dedup, bool sweep) {
+    dir_ = dir;
+    blobDir_ = dir + "/.blobs";
+    dedup_ = dedup;
+    if(!dedup_) {
+        return true;
+    }
+    if(mkdir(blobDir_.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOG_ERROR("BlobStore mkdir %s error", blobDir_.c_str());
+        dedup_ = false;
+        return false;
+    }
+    DIR* dp = opendir(blobDir_.c_str());
+    if(!dp) {
+        LOG_ERROR("BlobStore opendir %s error", blobDir_.c_str());
+        dedup_ = false;
+        return false;
+    }
+    lock_guard<mutex> locker(mtx_);
+    digests_.clear();
+    int orphan = 0;
+    struct dirent* ent;
+    while((ent = readdir(dp)) != nullptr) {
+        if(ent->d_name[0] == '.') {
+            continue;
+        }
+        string path = blobDir_ + "/" + ent->d_name;
+        struct stat st;
+        if(stat(path.c_str(), &st) < 0) {
+            continue;
+        }
+        //退出的进程没来得及改名的临时文件，热重启时旧进程还活着，它的临时文件不能动
+        if(strncmp(ent->d_name, "tmp.", 4) == 0) {
+            if(StaleTemp_(ent->d_name)) {
+                unlink(path.c_str());
+                ++orphan;
+            }
+            continue;
+        }
+        //已经没有文件名引用的blob
+        if(st.st_nlink <= 1 && sweep) {
+            unlink(path.c_str());
+            ++orphan;
+            continue;
+        }
+        digests_[st.st_ino] = ent->d_name;
+    }
+    closedir(dp);
+    LOG_INFO("BlobStore %s: %d blobs, %d removed", blobDir_.c_str(), static_cast<int>(digests_.size()), orphan);
+    return true;
+}
+
+bool BlobStore::Save(const string& name, const char* data, size_t len) {
+    string path = dir_ + "/" + name;
+    if(!dedup_) {
+        return WriteFile_(path, data, len);
+    }
+    //摘要在锁外面算，大文件不会挡住别的上传
+    Sha256 sha;
+    sha.Update(data, len);
+    uint8_t digest[Sha256::DIGEST_LEN];
+    sha.Final(digest);
+    string hex = Sha256::ToHex(digest, Sha256::DIGEST_LEN);
+    string blob = blobDir_ + "/" + hex;
+
+    struct stat st;
+    unique_lock<mutex> locker(mtx_);
+    if(stat(blob.c_str(), &st) < 0) {
+        //第一次出现的内容才需要写盘，写的时候不拿锁
+        locker.unlock();
+        string temp = TempPath_();
+        if(!WriteFile_(temp, data, len)) {
+            unlink(temp.c_str());
+            return false;
+        }
+        locker.lock();
+        //同样的内容可能被别的线程先存好了，用link而不是rename，已经有了就用现成的
+        if(link(temp.c_str(), blob.c_str()) < 0 && errno != EEXIST) {
+            LOG_ERROR("BlobStore link %s error", blob.c_str());
+            unlink(temp.c_str());
+            return false;
+        }
+        unlink(temp.c_str());
+        if(stat(blob.c_str(), &st) < 0) {
+            return false;
+        }
+        digests_[st.st_ino] = hex;
+    } else {
+        LOG_DEBUG("BlobStore %s already stored as %s", name.c_str(), hex.c_str());
+    }
+    //先在.blobs里建一个临时链接，再改名成文件名，替换同名文件时下载中的客户看到的还是旧内容
+    string temp = TempPath_();
+    if(link(blob.c_str(), temp.c_str()) < 0) {
+        LOG_ERROR("BlobStore link %s error", temp.c_str());
+        return false;
+    }
+    struct stat old;
+    bool replaced = stat(path.c_str(), &old) == 0;
+    if(rename(temp.c_str(), path.c_str()) < 0) {
+        LOG_ERROR("BlobStore rename %s error", path.c_str());
+        unlink(temp.c_str());
+        return false;
+    }
+    if(replaced && old.st_ino != st.st_ino) {
+        Release_(old.st_ino, old.st_nlink);
+    }
+    return true;
+}
+
+bool BlobStore::Remove(const string& name) {
+    string path = dir_ + "/" + name;
+    if(!dedup_) {
+        return unlink(path.c_str()) == 0;
+    }
+    lock_guard<mutex> locker(mtx_);
+    struct stat st;
+    if(stat(path.c_str(), &st) < 0 || unlink(path.c_str()) < 0) {
+        return false;
+    }
+    Release_(st.st_ino, st.st_nlink);
+    return true;
+}
+
+bool BlobStore::WriteFile_(const string& path, const char* data, size_t len) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        LOG_ERROR("BlobStore open %s error", path.c_str());
+        return false;
+    }
+    while(len > 0) {
+        ssize_t n = write(fd, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("BlobStore write %s error", path.c_str());
+            close(fd);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    close(fd);
+    return true;
+}
+
+string BlobStore::TempPath_() {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/tmp.%d.%u", static_cast<int>(getpid()), tempSeq_++);
+    return blobDir_ + buf;
+}
+
+void BlobStore::Release_(ino_t ino, nlink_t nlink) {
+    unordered_map<ino_t, string>::iterator it = digests_.find(ino);
+    if(it == digests_.end()) {
+        //只有一个链接的不是去重保存的文件，有多个链接的可能是热重启时另一个进程存的，去目录里找
+        if(nlink < 2 || !Find_(ino)) {
+            return;
+        }
+        it = digests_.find(ino);
+    }
+    string blob = blobDir_ + "/" + it->second;
+    struct stat st;
+    if(stat(blob.c_str(), &st) == 0 && st.st_ino == ino && st.st_nlink <= 1) {
+        unlink(blob.c_str());
+        digests_.erase(it);
+    }
+}
+
+bool BlobStore::Find_(ino_t ino) {
+    DIR* dp = opendir(blobDir_.c_str());
+    if(!dp) {
+        return false;
+    }
+    bool found = false;
+    struct dirent* ent;
+    while((ent = readdir(dp)) != nullptr) {
+        if(ent->d_name[0] == '.' || strncmp(ent->d_name, "tmp.", 4) == 0) {
+            continue;
+        }
+        string path = blobDir_ + "/" + ent->d_name;
+        struct stat st;
+        if(stat(path.c_str(), &st) == 0 && st.st_ino == ino) {
+            digests_[ino] = ent->d_name;
+            found = true;
+            break;
+        }
+    }
+    closedir(dp);
+    return found;
+}
+
+bool BlobStore::StaleTemp_(const char* name) {
+    int pid = atoi(name + 4);
+    if(pid <= 0) {
+        return true;
+    }
+    //自己的进程号说明是以前用过同一个进程号的进程留下的，这时还没开始上传
+    return pid == getpid() || (kill(pid, 0) < 0 && errno == ESRCH);
+}
@@ -0,0 +1,63 @@
+#ifndef BLOBSTORE_H
+#define BLOBSTORE_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "../sha256/sha256.h"
+#include "../log/log.h"
+
+//上传文件的保存，打开去重时按内容寻址，每种内容只在dir/.blobs/<sha256>保存一份
+//用户看到的文件名是指向blob的硬链接，目录项就是文件名到摘要的映射，下载、删除和目录索引都不用改
+//同一份内容被多次上传时只算一遍摘要再建一个链接，不再写盘，热门文件在页缓存里也只有一份
+//blob的链接数只剩1时说明没有文件名在用它了，就删掉
+class BlobStore {
+public:
+    static BlobStore* Instance();
+
+    //dedup为false时和原来一样直接写文件；为true时建立.blobs目录，清理上次遗留的临时文件和没人用的blob
+    //sweep为false时不删没有文件名引用的blob，热重启时旧进程还在处理上传，它刚写好的blob可能还没链接上文件名
+    bool Init(const std::string& dir, bool dedup, bool sweep = true);
+    //保存上传的文件，同名文件会被替换
+    bool Save(const std::string& name, const char* data, size_t len);
+    //删除文件，去重时顺便回收不再被引用的blob
+    bool Remove(const std::string& name);
+    bool IsDedup() const { return dedup_; }
+
+private:
+    BlobStore();
+    ~BlobStore() = default;
+
+    //把data写到path，写完才算成功
+    static bool WriteFile_(const std::string& path, const char* data, size_t len);
+    std::string TempPath_();
+    //文件名原来指向的blob没人用了就删掉，nlink是删掉文件名之前的链接数，调用时要拿着mtx_
+    void Release_(ino_t ino, nlink_t nlink);
+    //在.blobs里找inode是ino的blob并记下来，热重启时另一个进程存的blob不在digests_里
+    bool Find_(ino_t ino);
+    //临时文件名里带着进程号，只删已经退出的进程留下的
+    static bool StaleTemp_(const char* name);
+
+    std::string dir_;
+    std::string blobDir_;
+    bool dedup_;
+    std::atomic<unsigned int> tempSeq_;
+    //保存、删除和回收时链接数的检查要一起做，不然刚判断没人用就被新上传的链接上了
+    std::mutex mtx_;
+    std::unordered_map<ino_t, std::string> digests_;//blob的inode到摘要，删除文件时靠它找到blob
+    static BlobStore* storeptr;
+};
+
+#endif //BLOBSTORE_H
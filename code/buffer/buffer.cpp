@@ -84,7 +84,7 @@ void Buffer::EnsureWriteable(size_t len) {
     assert(WritableBytes() >= len);
 }
 
-ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
+ssize_t Buffer::ReadFd(int fd, int* saveErrno, size_t* room) {
     //其实也没必要这样分散读，就直接读到buff中，然后再append到缓冲区也可以
     char buff[65535];
     struct iovec iov[2];
@@ -95,6 +95,9 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno) {
     iov[0].iov_len = writable;
     iov[1].iov_base = buff;
     iov[1].iov_len = sizeof(buff);
+    if(room) {
+        *room = writable + sizeof(buff);
+    }
 
     const ssize_t len = readv(fd, iov, 2);
     if(len < 0) {
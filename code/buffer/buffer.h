@@ -36,7 +36,8 @@ public:
     void Append(const void* data, size_t len);
     void Append(const Buffer& buff);
 
-    ssize_t ReadFd(int fd, int* Errno);
+    //room不为空时带出这次最多能读的字节数，读到的比它少说明套接字里的数据已经取完了
+    ssize_t ReadFd(int fd, int* Errno, size_t* room = nullptr);
     ssize_t WriteFd(int fd, int* Errno);
 
 
@@ -0,0 +1,145 @@
+#include "config.h"
+
+using namespace std;
+
+Config* Config::configptr = new Config;
+
+Config::Config() : auto_(false) {}
+
+Config* Config::Instance() {
+    return configptr;
+}
+
+static string Trim(const string& s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if(begin == string::npos) {
+        return "";
+    }
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+bool Config::Load(const string& path) {
+    path_ = path;
+    ifstream in(path.c_str());
+    if(!in) {
+        LOG_WARN("Config %s not found, use defaults", path.c_str());
+        return false;
+    }
+    unordered_map<string, string> values;
+    string line;
+    int lineNo = 0;
+    while(getline(in, line)) {
+        ++lineNo;
+        size_t pos = line.find('#');
+        if(pos != string::npos) {
+            line.erase(pos);
+        }
+        line = Trim(line);
+        if(line.empty()) {
+            continue;
+        }
+        pos = line.find('=');
+        string key = pos == string::npos ? "" : Trim(line.substr(0, pos));
+        if(key.empty()) {
+            LOG_WARN("Config %s:%d bad line", path.c_str(), lineNo);
+            continue;
+        }
+        values[key] = Trim(line.substr(pos + 1));
+    }
+    values_.swap(values);
+    unordered_map<string, string>::const_iterator it = values_.find("mode");
+    auto_ = it != values_.end() && it->second == "auto";
+    LOG_INFO("Config %s loaded, %d keys, mode %s", path.c_str(), static_cast<int>(values_.size()), auto_ ? "auto" : "manual");
+    return true;
+}
+
+bool Config::Reload() {
+    return !path_.empty() && Load(path_);
+}
+
+bool Config::Find_(const string& key, string& value) const {
+    unordered_map<string, string>::const_iterator it = values_.find(key);
+    if(it == values_.end() || it->second == "auto") {
+        return false;
+    }
+    value = it->second;
+    return true;
+}
+
+int Config::GetInt(const string& key, int def, int autoValue) const {
+    string value;
+    if(!Find_(key, value)) {
+        //没写的key在auto模式下也自动计算，写成auto的key不管什么模式都自动计算
+        return auto_ || values_.count(key) ? autoValue : def;
+    }
+    char* end = nullptr;
+    long n = strtol(value.c_str(), &end, 10);
+    if(end == value.c_str() || *end != '\0') {
+        LOG_WARN("Config %s = %s is not an integer", key.c_str(), value.c_str());
+        return def;
+    }
+    return static_cast<int>(n);
+}
+
+long long Config::GetLong(const string& key, long long def) const {
+    string value;
+    if(!Find_(key, value)) {
+        return def;
+    }
+    char* end = nullptr;
+    long long n = strtoll(value.c_str(), &end, 10);
+    if(end == value.c_str() || *end != '\0') {
+        LOG_WARN("Config %s = %s is not an integer", key.c_str(), value.c_str());
+        return def;
+    }
+    return n;
+}
+
+double Config::GetDouble(const string& key, double def) const {
+    string value;
+    if(!Find_(key, value)) {
+        return def;
+    }
+    char* end = nullptr;
+    double n = strtod(value.c_str(), &end);
+    if(end == value.c_str() || *end != '\0') {
+        LOG_WARN("Config %s = %s is not a number", key.c_str(), value.c_str());
+        return def;
+    }
+    return n;
+}
+
+bool Config::GetBool(const string& key, bool def) const {
+    string value;
+    if(!Find_(key, value)) {
+        return def;
+    }
+    if(value == "true" || value == "on" || value == "yes" || value == "1") {
+        return true;
+    }
+    if(value == "false" || value == "off" || value == "no" || value == "0") {
+        return false;
+    }
+    LOG_WARN("Config %s = %s is not a bool", key.c_str(), value.c_str());
+    return def;
+}
+
+string Config::GetString(const string& key, const string& def) const {
+    unordered_map<string, string>::const_iterator it = values_.find(key);
+    return it == values_.end() ? def : it->second;
+}
+
+int Config::Cores() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? static_cast<int>(n) : 1;
+}
+
+long long Config::MemoryBytes() {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGE_SIZE);
+    if(pages <= 0 || pageSize <= 0) {
+        return 1LL << 30;//取不到时按1G算
+    }
+    return static_cast<long long>(pages) * pageSize;
+}
@@ -0,0 +1,52 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include <fstream>
+
+#include "../log/log.h"
+
+//运行时配置，启动时从配置文件读取，收到SIGHUP时由主线程重新读取
+//文件每行一个key = value，#后面是注释，没有写的key用编译时的默认值
+//mode = auto时，没有写的线程数、连接数、队列长度等按CPU核数、内存和描述符上限计算，单独某个key写成auto也一样
+//只在主线程使用
+class Config {
+public:
+    static Config* Instance();
+
+    //读取配置文件，文件打不开时返回false，所有key都用默认值
+    bool Load(const std::string& path);
+    //重新读取上次的文件，读不到时保留原来的配置
+    bool Reload();
+    bool IsAuto() const { return auto_; }
+
+    //没有配置时返回def；配置成auto，或者mode = auto且没有配置时返回autoValue
+    int GetInt(const std::string& key, int def, int autoValue) const;
+    int GetInt(const std::string& key, int def) const { return GetInt(key, def, def); }
+    long long GetLong(const std::string& key, long long def) const;
+    double GetDouble(const std::string& key, double def) const;
+    //true/false、on/off、yes/no、1/0都可以
+    bool GetBool(const std::string& key, bool def) const;
+    std::string GetString(const std::string& key, const std::string& def) const;
+
+    //auto模式计算用到的机器资源
+    static int Cores();
+    static long long MemoryBytes();
+
+private:
+    Config();
+    ~Config() = default;
+
+    //找到key并且不是auto时返回true
+    bool Find_(const std::string& key, std::string& value) const;
+
+    std::string path_;
+    bool auto_;
+    std::unordered_map<std::string, std::string> values_;
+    static Config* configptr;
+};
+
+#endif //CONFIG_H
@@ -0,0 +1,73 @@
+/*
+协程的任务类型，只在用C++20编译并定义了USE_COROUTINE时使用(make CORO=1)
+每个连接一个协程，创建后先挂起，由工作线程在Process中恢复，
+协程在等待套接字、数据库、定时器时挂起，挂起的只是一个协程帧，不占用工作线程
+恢复都是由主线程把连接放回线程池，再由工作线程执行的，同一时刻只会有一个线程在执行一个连接的协程
+
+*/
+#ifndef COTASK_H
+#define COTASK_H
+
+#ifdef USE_COROUTINE
+
+#include <coroutine>
+#include <exception>
+#include "../log/log.h"
+
+class CoTask{
+public:
+    struct promise_type{
+        CoTask get_return_object() {
+            return CoTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        //创建后先挂起，等第一次有数据读到再开始
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        //结束后也挂起，协程帧由CoTask释放
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            LOG_ERROR("coroutine exception");
+            std::terminate();
+        }
+    };
+
+    CoTask() : m_handle(nullptr) {}
+    explicit CoTask(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+    CoTask(CoTask&& other) noexcept : m_handle(other.m_handle) {
+        other.m_handle = nullptr;
+    }
+    CoTask& operator=(CoTask&& other) noexcept {
+        if(this != &other) {
+            Destroy();
+            m_handle = other.m_handle;
+            other.m_handle = nullptr;
+        }
+        return *this;
+    }
+    CoTask(const CoTask&) = delete;
+    CoTask& operator=(const CoTask&) = delete;
+    ~CoTask() { Destroy(); }
+
+    bool Valid() const { return m_handle != nullptr; }
+    bool Done() const { return !m_handle || m_handle.done(); }
+    //从上次挂起的地方接着执行，直到下一次挂起或者结束
+    void Resume() {
+        if(m_handle && !m_handle.done()) {
+            m_handle.resume();
+        }
+    }
+
+private:
+    void Destroy() {
+        if(m_handle) {
+            m_handle.destroy();
+            m_handle = nullptr;
+        }
+    }
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+#include "cotimer.h"
+
+CoTimer* CoTimer::timerptr = new CoTimer;
+
+CoTimer* CoTimer::Instance() {
+    return timerptr;
+}
+
+CoTimer::CoTimer() : wakeFd_(-1) {}
+
+CoTimer::~CoTimer() {
+    if(wakeFd_ >= 0) {
+        close(wakeFd_);
+    }
+}
+
+bool CoTimer::Init(Poller* poller) {
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0) {
+        LOG_ERROR("CoTimer eventfd error");
+        return false;
+    }
+    return poller->Add(wakeFd_, EPOLLIN);
+}
+
+void CoTimer::Add(int ms, const Callback& cb) {
+    Node node;
+    node.expires = Clock::now() + std::chrono::milliseconds(ms);
+    node.cb = cb;
+    bool earliest;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        earliest = heap_.empty() || node.expires < heap_.top().expires;
+        heap_.push(node);
+    }
+    //主线程可能按原来的时间在等，要让它重新算一次
+    if(earliest && wakeFd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeFd_, &one, sizeof(one));
+        (void)ret;
+    }
+}
+
+int CoTimer::Tick() {
+    std::vector<Callback> expired;
+    int next = -1;
+    {
+        std::lock_guard<std::mutex> locker(mtx_);
+        Clock::time_point now = Clock::now();
+        while(!heap_.empty() && heap_.top().expires <= now) {
+            expired.push_back(heap_.top().cb);
+            heap_.pop();
+        }
+        if(!heap_.empty()) {
+            next = std::chrono::duration_cast<std::chrono::milliseconds>(heap_.top().expires - now).count() + 1;
+        }
+    }
+    //回调里可能又添加定时器，不能拿着锁执行
+    for(Callback& cb : expired) {
+        cb();
+    }
+    return next;
+}
+
+void CoTimer::HandleEvent() {
+    uint64_t count;
+    while(read(wakeFd_, &count, sizeof(count)) > 0) {}
+}
@@ -0,0 +1,53 @@
+/*
+给协程用的定时器，协程要等一段时间时把恢复的回调放进来，到时间后在主线程执行回调
+HeapTimer的回调只能是函数指针并且按套接字去重，放不下协程的恢复，所以单独实现
+任何线程都可以添加，新的定时器比原来最早的还早时，通过eventfd唤醒主线程重新计算等待时间
+
+*/
+#ifndef COTIMER_H
+#define COTIMER_H
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <vector>
+#include "../poller/poller.h"
+#include "../log/log.h"
+
+class CoTimer{
+public:
+    typedef std::function<void()> Callback;
+
+    static CoTimer* Instance();
+
+    //创建唤醒用的eventfd并注册到事件后端
+    bool Init(Poller* poller);
+    //ms毫秒后在主线程执行cb，任何线程都可以调用
+    void Add(int ms, const Callback& cb);
+    //主线程调用，执行所有到期的回调，返回距离下一个到期还有多少ms，没有定时器返回-1
+    int Tick();
+    //主线程调用，判断事件后端返回的fd是不是唤醒用的eventfd
+    bool Owns(int fd) const { return fd == wakeFd_; }
+    void HandleEvent();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Node{
+        Clock::time_point expires;
+        Callback cb;
+        bool operator>(const Node& t) const { return expires > t.expires; }
+    };
+
+    CoTimer();
+    ~CoTimer();
+
+    std::mutex mtx_;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> heap_;
+    int wakeFd_;
+    static CoTimer* timerptr;
+};
+
+#endif
@@ -0,0 +1,181 @@
+#include "egress.h"
+#include <algorithm>
+#include "../http/http_conn.h"
+
+using namespace std;
+
+EgressScheduler* EgressScheduler::schedptr = new EgressScheduler;
+
+EgressScheduler::EgressScheduler()
+    : isOpen_(false), globalRate_(0), ipRate_(0), connRate_(0),
+      smallResponse_(0), quantum_(0), burstMs_(0), globalTokens_(0) {}
+
+EgressScheduler* EgressScheduler::Instance() {
+    return schedptr;
+}
+
+void EgressScheduler::Init(long long globalRate, long long ipRate, long long connRate,
+                           int smallResponse, int quantum, int burstMs) {
+    globalRate_ = globalRate > 0 ? globalRate : 0;
+    ipRate_ = ipRate > 0 ? ipRate : 0;
+    connRate_ = connRate > 0 ? connRate : 0;
+    smallResponse_ = smallResponse;
+    quantum_ = quantum > 0 ? quantum : 65536;
+    burstMs_ = burstMs > 0 ? burstMs : 100;
+    isOpen_ = globalRate_ > 0 || ipRate_ > 0 || connRate_ > 0;
+    globalTokens_ = globalRate_ * burstMs_ / 1000.0;
+    last_ = chrono::steady_clock::now();
+}
+
+void EgressScheduler::Charge(const sockaddr_in& addr, int bytes) {
+    if(bytes <= 0) {
+        return;
+    }
+    if(globalRate_ > 0) {
+        globalTokens_ -= bytes;
+    }
+    //没有大文件在发的IP也要记，不然只发小响应的客户端不受IP速率限制
+    if(ipRate_ > 0) {
+        Ip_(addr.sin_addr.s_addr).tokens -= bytes;
+    }
+}
+
+EgressScheduler::IpState& EgressScheduler::Ip_(uint32_t ip) {
+    unordered_map<uint32_t, IpState>::iterator it = ips_.find(ip);
+    if(it == ips_.end()) {
+        IpState state;
+        state.tokens = ipRate_ * burstMs_ / 1000.0;
+        state.flows = 0;
+        it = ips_.insert(make_pair(ip, state)).first;
+    }
+    return it->second;
+}
+
+void EgressScheduler::Enqueue(Http_Conn* conn, const sockaddr_in& addr) {
+    unordered_map<Http_Conn*, Flow>::iterator it = flows_.find(conn);
+    if(it == flows_.end()) {
+        Flow flow;
+        flow.ip = addr.sin_addr.s_addr;
+        flow.tokens = connRate_ * burstMs_ / 1000.0;
+        flow.queued = false;
+        ++Ip_(flow.ip).flows;
+        it = flows_.insert(make_pair(conn, flow)).first;
+    }
+    if(it->second.queued) {
+        return;
+    }
+    //配额沿用上次离开队列时的，只有差额重新开始
+    it->second.deficit = 0;
+    it->second.queued = true;
+    active_.push_back(conn);
+    //配额还有剩余的话马上开始发，不用等下一次补充
+    Run_();
+}
+
+void EgressScheduler::Remove(Http_Conn* conn) {
+    //重新读取配置关掉调度后，队列里的连接还会发完，所以看的是队列而不是开关
+    if(flows_.empty()) {
+        return;
+    }
+    unordered_map<Http_Conn*, Flow>::iterator it = flows_.find(conn);
+    if(it == flows_.end()) {
+        return;
+    }
+    if(it->second.queued) {
+        deque<Http_Conn*>::iterator pos = find(active_.begin(), active_.end(), conn);
+        if(pos != active_.end()) {
+            active_.erase(pos);
+        }
+    }
+    //IP的配额留着，等补满后由Tick删掉，同一个IP关掉连接再连上拿不到新的配额
+    --ips_[it->second.ip].flows;
+    flows_.erase(it);
+}
+
+void EgressScheduler::Tick() {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    double elapsed = chrono::duration_cast<chrono::microseconds>(now - last_).count() / 1000000.0;
+    last_ = now;
+    //每种配额最多攒burstMs的量，空闲一段时间后不会一下子把带宽占满
+    if(globalRate_ > 0) {
+        globalTokens_ = min(globalTokens_ + globalRate_ * elapsed, globalRate_ * burstMs_ / 1000.0);
+    }
+    //不在队列中的连接（等可写事件或者在处理下一个请求）也要补，补满后和新进队的一样，可以删掉
+    double connBurst = connRate_ * burstMs_ / 1000.0;
+    for(unordered_map<Http_Conn*, Flow>::iterator it = flows_.begin(); it != flows_.end();) {
+        it->second.tokens = min(it->second.tokens + connRate_ * elapsed, connBurst);
+        if(!it->second.queued && it->second.tokens >= connBurst) {
+            --ips_[it->second.ip].flows;
+            it = flows_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    //没有连接引用的IP补满后删掉，之前欠下的配额要先还清
+    double ipBurst = ipRate_ * burstMs_ / 1000.0;
+    for(unordered_map<uint32_t, IpState>::iterator it = ips_.begin(); it != ips_.end();) {
+        it->second.tokens = min(it->second.tokens + ipRate_ * elapsed, ipBurst);
+        if(it->second.flows <= 0 && it->second.tokens >= ipBurst) {
+            it = ips_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    Run_();
+}
+
+double EgressScheduler::Budget_(double tokens, long long rate) const {
+    return rate > 0 ? tokens : 1e18;
+}
+
+void EgressScheduler::Run_() {
+    //连续一整轮都没有连接能发送时停下，等下一次补充配额
+    size_t idle = 0;
+    while(!active_.empty() && idle < active_.size()) {
+        Http_Conn* conn = active_.front();
+        active_.pop_front();
+        Flow& flow = flows_[conn];
+        IpState& ip = Ip_(flow.ip);
+        flow.deficit += quantum_;
+        double limit = flow.deficit;
+        limit = min(limit, Budget_(flow.tokens, connRate_));
+        limit = min(limit, Budget_(ip.tokens, ipRate_));
+        limit = min(limit, Budget_(globalTokens_, globalRate_));
+        if(limit < 1) {
+            //配额用完的连接不攒差额，免得配额补回来后一次发太多
+            flow.deficit = min(flow.deficit, static_cast<long long>(quantum_));
+            active_.push_back(conn);
+            ++idle;
+            continue;
+        }
+        int sent = 0;
+        Http_Conn::WRITE_RESULT ret = conn->Write_Some(static_cast<int>(min(limit, 1e9)), sent);
+        flow.deficit = min(flow.deficit - sent, static_cast<long long>(quantum_));
+        flow.tokens -= sent;
+        ip.tokens -= sent;
+        if(globalRate_ > 0) {
+            globalTokens_ -= sent;
+        }
+        if(sent > 0) {
+            idle = 0;
+            if(onProgress_) {
+                onProgress_(conn);
+            }
+        } else {
+            ++idle;
+        }
+        switch(ret) {
+            case Http_Conn::WRITE_PARTIAL://份额用完了还没发完，排到队尾
+                active_.push_back(conn);
+                break;
+            case Http_Conn::WRITE_BLOCKED://套接字写不进去了，等可写事件后重新进队
+            case Http_Conn::WRITE_DONE:
+                flow.queued = false;
+                break;
+            default:
+                flow.queued = false;
+                conn->Close_Conn();
+                break;
+        }
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef EGRESS_H
+#define EGRESS_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+#include "../log/log.h"
+
+class Http_Conn;
+
+//下载的发送调度，只在主线程使用
+//小的响应（页面、错误提示）还是可写时立即发完，只把用掉的字节记到配额里，保证交互请求的延迟
+//大的响应不再一次写到EAGAIN，而是进入调度队列，按差额轮询(DRR)每轮给每个连接一个quantum的份额，
+//同时受全局、每个IP、每个连接的字节配额限制，配额由时间堆的周期任务按速率补充，大文件只能用剩下的带宽
+//三个速率都是0时不做调度，和原来一样
+class EgressScheduler {
+public:
+    static EgressScheduler* Instance();
+
+    //速率单位都是字节/秒，0表示不限制；smallResponse以内的响应立即发送；quantum是每轮每个连接的份额
+    //burstMs是配额最多能攒多少毫秒的量
+    void Init(long long globalRate, long long ipRate, long long connRate,
+              int smallResponse, int quantum, int burstMs);
+    bool IsOpen() const { return isOpen_; }
+    //这个大小的响应是否要交给调度
+    bool Shaping(long long bytes) const { return isOpen_ && bytes > smallResponse_; }
+    //小响应立即发送后，把发送的字节记到全局和IP的配额里，可以记成负数，大文件要等补回来
+    void Charge(const sockaddr_in& addr, int bytes);
+    //大响应的连接可写了，放进调度队列
+    void Enqueue(Http_Conn* conn, const sockaddr_in& addr);
+    //连接关闭回收前调用，从调度队列中去掉，并删掉这个连接的配额
+    void Remove(Http_Conn* conn);
+    //周期任务调用，按经过的时间补充配额，然后发送一轮
+    void Tick();
+    //调度发送了数据的连接会通过它通知主线程，用来延长连接的定时器
+    void SetProgressCallback(const std::function<void(Http_Conn*)>& cb) { onProgress_ = cb; }
+
+private:
+    EgressScheduler();
+    ~EgressScheduler() = default;
+
+    //连接和IP的配额在离开队列后还保留，下次进队接着用，不会每次可写都重新拿到一整份burst
+    //不在队列中的连接配额补满后删掉，连接关闭时也删掉；IP没有连接引用并且配额补满后才删掉，这时都和新建的一样
+    struct Flow {
+        uint32_t ip;
+        long long deficit;//DRR的差额，进队时清零
+        double tokens;//这个连接的配额
+        bool queued;//是否在active_中
+    };
+    struct IpState {
+        double tokens;
+        int flows;//引用这个IP的连接数，不为0时不删掉
+    };
+
+    //按DRR轮流发送，直到所有连接都发完、阻塞或者配额用完
+    void Run_();
+    IpState& Ip_(uint32_t ip);
+    double Budget_(double tokens, long long rate) const;
+
+    bool isOpen_;
+    long long globalRate_;
+    long long ipRate_;
+    long long connRate_;
+    int smallResponse_;
+    int quantum_;
+    int burstMs_;
+    double globalTokens_;
+    std::chrono::steady_clock::time_point last_;
+    std::unordered_map<Http_Conn*, Flow> flows_;
+    std::deque<Http_Conn*> active_;//DRR的轮询顺序
+    std::unordered_map<uint32_t, IpState> ips_;
+    std::function<void(Http_Conn*)> onProgress_;
+    static EgressScheduler* schedptr;
+};
+
+#endif //EGRESS_H
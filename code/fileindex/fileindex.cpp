@@ -0,0 +1,198 @@
+#include "fileindex.h"
+
+using namespace std;
+
+FileIndex* FileIndex::indexptr = new FileIndex;
+
+FileIndex::FileIndex() {}
+
+FileIndex::~FileIndex() {}
+
+FileIndex* FileIndex::Instance() {
+    return indexptr;
+}
+
+bool FileIndex::Init(const string& dir) {
+    dir_ = dir;
+    DIR* dp = opendir(dir.c_str());
+    if(!dp) {
+        LOG_ERROR("FileIndex opendir %s error", dir.c_str());
+        return false;
+    }
+    lock_.wrLock();
+    entries_.clear();
+    free_.clear();
+    struct dirent* ent;
+    while((ent = readdir(dp)) != nullptr) {
+        if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        Entry entry;
+        if(Stat_(ent->d_name, entry)) {
+            entries_.push_back(entry);
+        }
+    }
+    closedir(dp);
+    //启动时一次排好，不用逐个插入
+    for(int key = 0; key < SORT_KEY_NUM; ++key) {
+        vector<int>& order = order_[key];
+        order.resize(entries_.size());
+        for(size_t i = 0; i < order.size(); ++i) {
+            order[i] = static_cast<int>(i);
+        }
+        sort(order.begin(), order.end(), [this, key](int a, int b) {
+            return Less_(static_cast<SORT_KEY>(key), a, b);
+        });
+    }
+    size_t count = entries_.size();
+    lock_.unLock();
+    LOG_INFO("FileIndex %s: %d files", dir.c_str(), static_cast<int>(count));
+    return true;
+}
+
+void FileIndex::Update(const string& name) {
+    Entry entry;
+    if(!Stat_(name, entry)) {
+        Remove(name);
+        return;
+    }
+    lock_.wrLock();
+    int id = Find_(name);
+    if(id >= 0) {//覆盖上传，大小和时间变了，要先从有序数组中摘掉再按新值放回去
+        Erase_(id);
+        entries_[id] = entry;
+    } else if(!free_.empty()) {
+        id = free_.back();
+        free_.pop_back();
+        entries_[id] = entry;
+    } else {
+        id = static_cast<int>(entries_.size());
+        entries_.push_back(entry);
+    }
+    Insert_(id);
+    lock_.unLock();
+}
+
+void FileIndex::Remove(const string& name) {
+    lock_.wrLock();
+    int id = Find_(name);
+    if(id >= 0) {
+        Erase_(id);
+        entries_[id].name.clear();
+        free_.push_back(id);
+    }
+    lock_.unLock();
+}
+
+size_t FileIndex::List(const Query& query, vector<Entry>& page) {
+    page.clear();
+    int pageSize = query.pageSize;
+    if(pageSize <= 0) {
+        pageSize = DEFAULT_PAGE_SIZE;
+    } else if(pageSize > MAX_PAGE_SIZE) {
+        pageSize = MAX_PAGE_SIZE;
+    }
+    size_t offset = static_cast<size_t>(query.page > 1 ? query.page - 1 : 0) * pageSize;
+    const string& keyword = query.keyword;
+    size_t total = 0;
+
+    lock_.rdLock();
+    const vector<int>& order = order_[query.sort];
+    size_t n = order.size();
+    if(keyword.empty() || (query.prefix && query.sort == SORT_NAME)) {
+        //不搜索是整个数组，按文件名排序的前缀搜索是二分出来的一段连续范围
+        size_t lo = 0, hi = n;
+        if(!keyword.empty()) {
+            lo = lower_bound(order.begin(), order.end(), keyword, [this](int id, const string& key) {
+                return entries_[id].name < key;
+            }) - order.begin();
+            hi = partition_point(order.begin() + lo, order.end(), [this, &keyword](int id) {
+                return entries_[id].name.compare(0, keyword.size(), keyword) == 0;
+            }) - order.begin();
+        }
+        total = hi - lo;
+        for(size_t i = offset; i < total && i < offset + pageSize; ++i) {
+            page.push_back(entries_[order[query.desc ? hi - 1 - i : lo + i]]);
+        }
+    } else {
+        //其余的搜索要扫一遍，按要求的顺序数出匹配的条目，落在这一页的取出来
+        for(size_t i = 0; i < n; ++i) {
+            const Entry& entry = entries_[order[query.desc ? n - 1 - i : i]];
+            bool match = query.prefix ? entry.name.compare(0, keyword.size(), keyword) == 0
+                                      : entry.name.find(keyword) != string::npos;
+            if(!match) {
+                continue;
+            }
+            if(total >= offset && total < offset + pageSize) {
+                page.push_back(entry);
+            }
+            ++total;
+        }
+    }
+    lock_.unLock();
+    return total;
+}
+
+size_t FileIndex::Count() {
+    lock_.rdLock();
+    size_t count = order_[SORT_NAME].size();
+    lock_.unLock();
+    return count;
+}
+
+bool FileIndex::Less_(SORT_KEY key, int a, int b) const {
+    const Entry& x = entries_[a];
+    const Entry& y = entries_[b];
+    if(key == SORT_SIZE && x.size != y.size) {
+        return x.size < y.size;
+    }
+    if(key == SORT_MTIME && x.mtime != y.mtime) {
+        return x.mtime < y.mtime;
+    }
+    return x.name < y.name;
+}
+
+void FileIndex::Insert_(int id) {
+    for(int key = 0; key < SORT_KEY_NUM; ++key) {
+        vector<int>& order = order_[key];
+        vector<int>::iterator pos = lower_bound(order.begin(), order.end(), id, [this, key](int a, int b) {
+            return Less_(static_cast<SORT_KEY>(key), a, b);
+        });
+        order.insert(pos, id);
+    }
+}
+
+void FileIndex::Erase_(int id) {
+    //顺序是唯一的，二分出来的位置就是这个条目
+    for(int key = 0; key < SORT_KEY_NUM; ++key) {
+        vector<int>& order = order_[key];
+        vector<int>::iterator pos = lower_bound(order.begin(), order.end(), id, [this, key](int a, int b) {
+            return Less_(static_cast<SORT_KEY>(key), a, b);
+        });
+        if(pos != order.end() && *pos == id) {
+            order.erase(pos);
+        }
+    }
+}
+
+int FileIndex::Find_(const string& name) const {
+    const vector<int>& order = order_[SORT_NAME];
+    vector<int>::const_iterator pos = lower_bound(order.begin(), order.end(), name, [this](int id, const string& key) {
+        return entries_[id].name < key;
+    });
+    if(pos != order.end() && entries_[*pos].name == name) {
+        return *pos;
+    }
+    return -1;
+}
+
+bool FileIndex::Stat_(const string& name, Entry& entry) const {
+    struct stat st;
+    if(stat((dir_ + "/" + name).c_str(), &st) < 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    entry.name = name;
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtime;
+    return true;
+}
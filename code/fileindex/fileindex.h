@@ -0,0 +1,76 @@
+#ifndef FILEINDEX_H
+#define FILEINDEX_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "../locker/locker.h"
+#include "../log/log.h"
+
+//./filedir的目录索引，启动时遍历一次目录，之后在上传和删除时增量维护，文件列表页面不用每次都readdir
+//条目放在一个数组里，按文件名、大小、修改时间各维护一个只放下标的有序数组，相同的大小或时间再按文件名排，保证顺序唯一
+//增删时二分找到位置再挪动下标，取一页是定位到起点后顺序取出，O(log n + 页大小)
+//按文件名排序时的前缀搜索也是二分出范围，其余的搜索需要扫一遍有序数组
+class FileIndex {
+public:
+    enum SORT_KEY { SORT_NAME = 0, SORT_SIZE, SORT_MTIME, SORT_KEY_NUM };
+
+    struct Entry {
+        std::string name;
+        long long size;
+        time_t mtime;
+    };
+
+    //分页查询的条件，page从1开始
+    struct Query {
+        int page;
+        int pageSize;
+        SORT_KEY sort;
+        bool desc;
+        std::string keyword;//为空表示不搜索
+        bool prefix;//true按前缀匹配，false按子串匹配
+        Query() : page(1), pageSize(DEFAULT_PAGE_SIZE), sort(SORT_NAME), desc(false), prefix(false) {}
+    };
+
+    static const int DEFAULT_PAGE_SIZE = 50;
+    static const int MAX_PAGE_SIZE = 500;
+
+    static FileIndex* Instance();
+
+    //遍历目录建立索引，只在启动时调用一次
+    bool Init(const std::string& dir);
+    //文件新建或被覆盖后调用，重新读取大小和修改时间，文件不存在了就从索引中删掉
+    void Update(const std::string& name);
+    //文件删除后调用
+    void Remove(const std::string& name);
+    //取出一页放到page中，返回满足条件的条目总数
+    size_t List(const Query& query, std::vector<Entry>& page);
+    size_t Count();
+
+private:
+    FileIndex();
+    ~FileIndex();
+
+    //key排序下a是否排在b前面
+    bool Less_(SORT_KEY key, int a, int b) const;
+    void Insert_(int id);
+    void Erase_(int id);
+    //在文件名有序数组中查找，找不到返回-1
+    int Find_(const std::string& name) const;
+    bool Stat_(const std::string& name, Entry& entry) const;
+
+    std::string dir_;
+    std::vector<Entry> entries_;//删除后留下的空位放到free_中复用
+    std::vector<int> free_;
+    std::vector<int> order_[SORT_KEY_NUM];
+    RWlocker lock_;//列表是读多写少，查询用读锁
+    static FileIndex* indexptr;
+};
+
+#endif
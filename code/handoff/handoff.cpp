@@ -0,0 +1,280 @@
+#include "handoff.h"
+#include "../socket_control/socket_control.h"
+#include "../http/http_conn.h"
+
+using namespace std;
+
+Handoff* Handoff::handoffptr = new Handoff;
+
+Handoff::Handoff()
+    : ctrlFd_(-1), channel_(-1), listenFd_(-1), drainMs_(0), draining_(false), poller_(nullptr) {}
+
+Handoff* Handoff::Instance() {
+    return handoffptr;
+}
+
+static bool MakeAddr(const string& path, sockaddr_un& addr) {
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("Handoff path %s too long", path.c_str());
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+    return true;
+}
+
+int Handoff::TakeOver(const string& path) {
+    sockaddr_un addr;
+    if(!MakeAddr(path, addr)) {
+        return -1;
+    }
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(sock < 0) {
+        return -1;
+    }
+    if(connect(sock, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        LOG_WARN("Handoff connect %s error: %s", path.c_str(), strerror(errno));
+        close(sock);
+        return -1;
+    }
+    //旧进程卡住时不能一直等下去
+    struct timeval tv = {3, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    char type = 0;
+    vector<int> fds;
+    int n = Recv_(sock, type, fds, 0);
+    if(n <= 0 || type != MSG_LISTEN || fds.size() != 1) {
+        LOG_ERROR("Handoff no listen socket from %s", path.c_str());
+        for(int fd : fds) {
+            close(fd);
+        }
+        close(sock);
+        return -1;
+    }
+    channel_ = sock;
+    LOG_INFO("Handoff took over listen socket from %s", path.c_str());
+    return fds[0];
+}
+
+bool Handoff::Init(const string& path, int listenfd, int drainMs, Poller* poller) {
+    path_ = path;
+    listenFd_ = listenfd;
+    drainMs_ = drainMs;
+    poller_ = poller;
+    //旧进程交接完还在收尾时，它那个控制套接字的文件名直接删掉换成自己的，旧进程不会再用
+    sockaddr_un addr;
+    if(!MakeAddr(path, addr)) {
+        return false;
+    }
+    ctrlFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if(ctrlFd_ < 0) {
+        LOG_ERROR("Handoff socket error");
+        return false;
+    }
+    unlink(path.c_str());
+    if(bind(ctrlFd_, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(ctrlFd_, 1) < 0) {
+        LOG_ERROR("Handoff bind %s error: %s", path.c_str(), strerror(errno));
+        close(ctrlFd_);
+        ctrlFd_ = -1;
+        return false;
+    }
+    //能连上来的就能拿走监听套接字，只给本用户访问
+    chmod(path.c_str(), 0600);
+    Addfd(poller_, ctrlFd_, false, false);
+    if(channel_ >= 0) {
+        Addfd(poller_, channel_, false, false);
+    }
+    return true;
+}
+
+void Handoff::HandleEvent(int fd, vector<int>& conns) {
+    if(fd == ctrlFd_) {
+        Accept_();
+    } else if(fd == channel_) {
+        Receive_(conns);
+    }
+}
+
+void Handoff::Accept_() {
+    int peer = accept4(ctrlFd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(peer < 0) {
+        return;
+    }
+    //上一次交接的通道还没收完就又重启了，旧的那个进程自己会退出，这里只和新进程打交道
+    if(channel_ >= 0) {
+        CloseChannel_();
+    }
+    struct timeval tv = {1, 0};
+    setsockopt(peer, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if(!Send_(peer, MSG_LISTEN, &listenFd_, 1)) {
+        LOG_ERROR("Handoff send listen socket error");
+        close(peer);
+        return;
+    }
+    channel_ = peer;
+    //监听套接字已经在新进程手里了，这边关掉自己的描述符，监听队列不受影响
+    Removefd(poller_, listenFd_);
+    close(listenFd_);
+    listenFd_ = -1;
+    //控制套接字的文件名已经归新进程了，不能删
+    Removefd(poller_, ctrlFd_);
+    close(ctrlFd_);
+    ctrlFd_ = -1;
+    draining_ = true;
+    deadline_ = chrono::steady_clock::now() + chrono::milliseconds(drainMs_);
+    //不会再有新连接进来，现在还在的连接就是要收尾的全部
+    tracked_.clear();
+    for(int i = 0; i < Http_Conn::m_hot_size; ++i) {
+        if(Http_Conn::m_hot_table[i].conn) {
+            tracked_.push_back(i);
+        }
+    }
+    LOG_INFO("Handoff listen socket handed over, draining %d connections", static_cast<int>(tracked_.size()));
+    //工作线程直接发送或者反应堆模式下会在工作线程里把连接标成空闲再注册读事件，交接前先停掉，
+    //第一次交接等到下一个周期，正在直接发送的工作线程早就注册完了，空闲的判断只剩主线程在做
+    Http_Conn::m_direct_write = false;
+    Http_Conn::m_reactor = false;
+}
+
+void Handoff::Drain() {
+    if(!draining_) {
+        return;
+    }
+    vector<int> idle;
+    size_t keep = 0;
+    for(size_t i = 0; i < tracked_.size(); ++i) {
+        Http_Conn* conn = Http_Conn::m_hot_table[tracked_[i]].conn;
+        if(!conn || conn->Slot() != tracked_[i]) {
+            continue;//已经关闭了
+        }
+        if(channel_ >= 0 && conn->IsIdle()) {
+            idle.push_back(tracked_[i]);
+        } else {
+            tracked_[keep++] = tracked_[i];
+        }
+    }
+    tracked_.resize(keep);
+    for(size_t i = 0; i < idle.size(); i += MAX_FDS) {
+        int n = static_cast<int>(min(idle.size() - i, static_cast<size_t>(MAX_FDS)));
+        if(!Send_(channel_, MSG_CONN, &idle[i], n)) {
+            //新进程不在了，剩下的连接留在这里，等处理完或者到期限
+            LOG_ERROR("Handoff send connections error");
+            CloseChannel_();
+            tracked_.insert(tracked_.end(), idle.begin() + i, idle.end());
+            return;
+        }
+        //新进程已经持有这些连接，这边只关掉自己的描述符，不会给客户端发FIN
+        //新进程还拿着同一个套接字，关闭时epoll不会自己删掉注册，要先删掉
+        for(int j = 0; j < n; ++j) {
+            Removefd(poller_, idle[i + j]);
+            Http_Conn::m_hot_table[idle[i + j]].conn->Close_Conn();
+        }
+        LOG_INFO("Handoff %d idle connections handed over", n);
+    }
+}
+
+bool Handoff::Done() {
+    if(!draining_) {
+        return false;
+    }
+    bool expired = chrono::steady_clock::now() >= deadline_;
+    if(Http_Conn::m_user_count > 0 && !expired) {
+        return false;
+    }
+    if(expired) {
+        LOG_WARN("Handoff drain timeout, %d connections dropped", Http_Conn::m_user_count);
+    }
+    if(channel_ >= 0) {
+        Send_(channel_, MSG_END, nullptr, 0);
+        CloseChannel_();
+    }
+    LOG_INFO("Handoff drain finished");
+    return true;
+}
+
+void Handoff::Receive_(vector<int>& conns) {
+    while(channel_ >= 0) {
+        char type = 0;
+        int n = Recv_(channel_, type, conns, MSG_DONTWAIT);
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        if(n <= 0 || type == MSG_END) {
+            //旧进程已经收尾结束
+            LOG_INFO("Handoff channel closed");
+            CloseChannel_();
+            return;
+        }
+    }
+}
+
+void Handoff::CloseChannel_() {
+    if(poller_ && !draining_) {
+        Removefd(poller_, channel_);//新进程这边通道在事件后端里
+    }
+    close(channel_);
+    channel_ = -1;
+}
+
+bool Handoff::Send_(int sock, char type, const int* fds, int n) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    if(n > 0) {
+        msg.msg_control = control.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * n);
+    }
+    ssize_t ret;
+    do {
+        ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while(ret < 0 && errno == EINTR);
+    return ret == 1;
+}
+
+int Handoff::Recv_(int sock, char& type, vector<int>& fds, int flags) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    struct iovec iov;
+    iov.iov_base = &type;
+    iov.iov_len = 1;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    int n = recvmsg(sock, &msg, flags | MSG_CMSG_CLOEXEC);
+    if(n <= 0) {
+        return n;
+    }
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        int* data = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+        for(int i = 0; i < count; ++i) {
+            fds.push_back(data[i]);
+        }
+    }
+    if(msg.msg_flags & MSG_CTRUNC) {
+        LOG_ERROR("Handoff control message truncated");
+    }
+    return n;
+}
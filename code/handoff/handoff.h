@@ -0,0 +1,68 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "../log/log.h"
+#include "../poller/poller.h"
+
+//热重启时新旧进程之间交接套接字，只在主线程使用
+//旧进程在一个Unix套接字上等着，新进程启动时连上来，旧进程用SCM_RIGHTS把监听套接字交过去后就不再accept，
+//监听队列里还没取走的连接由新进程接着取，不会被拒绝；旧进程手上正在处理的请求照常做完，
+//空闲的长连接陆续交给新进程，全部交完或者超过期限后旧进程退出
+//用SOCK_SEQPACKET保留消息边界，每条消息一个字节的类型，描述符放在控制消息里
+class Handoff {
+public:
+    enum MSG_TYPE { MSG_LISTEN = 'L', MSG_CONN = 'C', MSG_END = 'E' };
+
+    static Handoff* Instance();
+
+    //新进程启动时调用，连上path上的旧进程并拿到监听套接字，失败返回-1
+    //之后旧进程交过来的空闲连接从同一个通道上收
+    int TakeOver(const std::string& path);
+    //在path上等待下一次热重启，listenfd是要交出去的监听套接字，drainMs是交出去后等待请求处理完的期限
+    bool Init(const std::string& path, int listenfd, int drainMs, Poller* poller);
+    bool Owns(int fd) const { return fd >= 0 && (fd == ctrlFd_ || fd == channel_); }
+    //控制套接字或者通道上有事件，新进程收到的空闲连接放在conns中，由调用者接管
+    void HandleEvent(int fd, std::vector<int>& conns);
+    //监听套接字是否已经交出去，旧进程进入收尾
+    bool Draining() const { return draining_; }
+    //周期任务调用，把已经空闲的长连接交给新进程
+    void Drain();
+    //收尾结束了没有，结束时通知新进程不会再有连接过来
+    bool Done();
+
+private:
+    Handoff();
+    ~Handoff() = default;
+
+    static const int MAX_FDS = 250;//一条消息最多带的描述符，内核限制是253
+
+    static bool Send_(int sock, char type, const int* fds, int n);
+    //收一条消息，返回收到的字节数，描述符追加到fds中
+    static int Recv_(int sock, char& type, std::vector<int>& fds, int flags);
+    void Accept_();
+    void Receive_(std::vector<int>& conns);
+    void CloseChannel_();
+
+    std::string path_;
+    int ctrlFd_;//等待新进程连接的Unix套接字
+    int channel_;//和另一个进程之间的通道
+    int listenFd_;
+    int drainMs_;
+    bool draining_;
+    Poller* poller_;
+    std::chrono::steady_clock::time_point deadline_;
+    std::vector<int> tracked_;//交出监听套接字时还在的连接，之后只会减少
+    static Handoff* handoffptr;
+};
+
+#endif //HANDOFF_H
@@ -1,7 +1,19 @@
 #include "http_conn.h"
 
-int Http_Conn::m_epollfd = -1;
+Poller* Http_Conn::m_poller = nullptr;
 int Http_Conn::m_user_count = 0;
+int Http_Conn::m_buffer_size = 1024;
+std::function<bool(Http_Conn*)> Http_Conn::m_resume;
+std::atomic<bool> Http_Conn::m_direct_write(false);
+std::atomic<bool> Http_Conn::m_reactor(false);
+bool Http_Conn::m_coalesce = false;
+Locker Http_Conn::m_closed_mutex;
+std::vector<Http_Conn*> Http_Conn::m_closed;
+std::vector<std::pair<Http_Conn*, unsigned int>> Http_Conn::m_pipelined;
+int Http_Conn::m_pipelined_fd = -1;
+Http_Conn::Hot* Http_Conn::m_hot_table = nullptr;
+int Http_Conn::m_hot_size = 0;
+static_assert(sizeof(Http_Conn::Hot) == 64, "Hot must fit in one cache line");
 
 
 // 定义HTTP响应的一些状态信息
@@ -19,20 +31,110 @@ const char* error_500_form = "500,There was an unusual problem serving the reque
 //解析出一行时需要用到的字符串
 const char CRLF[] = "\r\n";
 
+//生成响应头用到的片段，都是预先拼好的，生成响应时只用memcpy拼起来，不再每一行都走一次vsnprintf
+struct Fragment{
+    const char* data;
+    size_t len;
+};
+#define FRAGMENT(s) { s, sizeof(s) - 1 }
+
+//用到的状态行，第一个是HTTP1.1的，第二个是HTTP1.0的，别的状态码还是格式化生成
+static const struct{
+    int status;
+    Fragment line[2];
+} status_lines[] = {
+    { 200, { FRAGMENT("HTTP/1.1 200 OK\r\n"), FRAGMENT("HTTP/1.0 200 OK\r\n") } },
+    { 400, { FRAGMENT("HTTP/1.1 400 Bad Request\r\n"), FRAGMENT("HTTP/1.0 400 Bad Request\r\n") } },
+    { 403, { FRAGMENT("HTTP/1.1 403 Forbidden\r\n"), FRAGMENT("HTTP/1.0 403 Forbidden\r\n") } },
+    { 404, { FRAGMENT("HTTP/1.1 404 Not Found\r\n"), FRAGMENT("HTTP/1.0 404 Not Found\r\n") } },
+    { 500, { FRAGMENT("HTTP/1.1 500 Internal Error\r\n"), FRAGMENT("HTTP/1.0 500 Internal Error\r\n") } },
+};
+static const Fragment download_header = FRAGMENT("Content-Disposition: attachment\r\n");
+static const Fragment cookie_begin = FRAGMENT("Set-Cookie: sessionid=");
+static const Fragment cookie_end = FRAGMENT("; Path=/; HttpOnly\r\n");
+static const Fragment length_header = FRAGMENT("Content-Length: ");
+//长度后面的换行、是否保持连接和空行拼在一起，下标是linger
+static const Fragment linger_tail[2] = {
+    FRAGMENT("\r\nConnection: close\r\n\r\n"),
+    FRAGMENT("\r\nConnection: keep-alive\r\n\r\n"),
+};
+
+//把非负整数写成十进制，从end往前写，返回第一个数字的位置，查表一次写两位
+static char* FormatUint(char* end, unsigned long value){
+    static const char digits[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    while(value >= 100){
+        size_t i = (value % 100) * 2;
+        value /= 100;
+        *--end = digits[i + 1];
+        *--end = digits[i];
+    }
+    if(value >= 10){
+        size_t i = value * 2;
+        *--end = digits[i + 1];
+        *--end = digits[i];
+    }else{
+        *--end = static_cast<char>('0' + value);
+    }
+    return end;
+}
+
+static char* Put(char* dest, const char* data, size_t len){
+    memcpy(dest, data, len);
+    return dest + len;
+}
+
 //---------------------------------------
 
+bool Http_Conn::InitHotTable(int size){
+    size_t bytes = sizeof(Hot) * size;
+    //映射出来的内存按页对齐并且全是0，满足64字节对齐，conn也都是空
+    void* table = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(table == MAP_FAILED){
+        LOG_ERROR("mmap hot table error");
+        return false;
+    }
+    m_hot_table = static_cast<Hot*>(table);
+    m_hot_size = size;
+    return true;
+}
+
+void Http_Conn::FreeHotTable(){
+    if(m_hot_table){
+        munmap(m_hot_table, sizeof(Hot) * m_hot_size);
+        m_hot_table = nullptr;
+        m_hot_size = 0;
+    }
+}
+
 //主线程调用
 void Http_Conn::Init(int sockfd,const sockaddr_in& addr){
+    m_hot = &m_hot_table[sockfd];
+    m_hot->conn = this;
     m_sockfd = sockfd;
     m_address = addr;
-    //设置一个端口复用，调试的时候用，实际使用不需要用
-    int reuse =1;
-    setsockopt(sockfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-    //在任务内部里把sockfd加入epollfd中
-    Addfd(m_epollfd,sockfd,true,true);
-    mutex.Lock();
+    m_incoming_cpu = CpuAffinity::Instance()->IncomingCpu(sockfd);
+    //在任务内部里把sockfd加入事件后端中
+    //accept4时已经是非阻塞的，热重启交过来的套接字和旧进程共用文件状态，也已经是非阻塞的
+    Addfd(m_poller,sockfd,true,true,false);
+    m_closed_mutex.Lock();
     ++m_user_count;
-    mutex.unLock();
+    m_closed_mutex.unLock();
+    ++m_generation;
+    m_async_done = false;
+    m_idle = true;
+    m_lane = LANE_STATIC;
+    m_io_task = TASK_PROCESS;
+    m_hot->corked = false;
+    m_hot->held = false;
+#ifdef USE_COROUTINE
+    //旧的协程如果还挂着就直接销毁，换成新连接的协程
+    m_task = Serve();
+#endif
 
     m_read_buffer.RetrieveAll();
     //读缓存只用初始化即可，为了解决粘包问题，不需要读完后清空，其实写缓存也不需要，但为了实现简单，就清理了
@@ -44,41 +146,116 @@ void Http_Conn::Init(int sockfd,const sockaddr_in& addr){
 }
 void Http_Conn::Clean(){
 
-    m_check_state = CHECK_STATE_REQUESTLINE;
+    m_hot->check_state = CHECK_STATE_REQUESTLINE;
 
     m_url.clear();
-    m_version.clear();
+    m_http10 = false;
     m_content_type.clear();
     m_boundary.clear();
+    m_session.clear();
+    m_set_cookie.clear();
     m_mehtod = GET;
     m_content_length = 0; 
-    m_linger =false;
-    m_bytes_to_send=0;
-    m_bytes_have_send =0;
+    m_hot->linger =false;
+    m_hot->bytes_to_send=0;
+    m_hot->bytes_have_send =0;
     m_write_buffer.RetrieveAll();
-    memset(m_real_file,'\0',FILENAME_LEN);
+    m_real_file.clear();
+    m_content.clear();
     m_isdownload = false;
+    post_.clear();//上一次请求的用户名密码不能留给下一次请求
     
 }
 
 
 void Http_Conn::Close_Conn(){
-    if(m_sockfd!=-1){
-        LOG_INFO("Client[%d] quit!", m_sockfd);
-        Removefd(m_epollfd,m_sockfd);
-        close(m_sockfd);
-        m_sockfd=-1;
-        mutex.Lock();
-        --m_user_count;//总的连接数量减一
-        mutex.unLock();
+    //定时器和工作线程可能同时关闭，先在锁里把套接字换成-1，保证只关闭一次、只回收一次
+    mutex.Lock();
+    int sockfd = m_sockfd;
+    m_sockfd = -1;
+    mutex.unLock();
+    if(sockfd == -1){
+        return;
+    }
+    LOG_INFO("Client[%d] quit!", sockfd);
+    //套接字先不关，别的工作线程可能还拿着这个连接，描述符和热数据表的位置要等它们做完才能给新连接
+    //注册在Reclaim真正关闭时才会消失，这之间残留的事件找到的还是这个已关闭的对象，读写都会失败，不会碰到别的连接
+    Forgetfd(m_poller,sockfd);
+    m_closed_mutex.Lock();
+    --m_user_count;//总的连接数量减一
+    m_closing_fd = sockfd;
+    //对象还不能直接复用，主线程的连接表和定时器还指着它，交给主线程回收
+    bool wake = m_closed.empty();
+    m_closed.push_back(this);
+    m_closed_mutex.unLock();
+    //套接字要等主线程回收时才关，工作线程关闭的连接要唤醒主线程，不然客户端要等到下一个事件才收到FIN
+    uint64_t one = 1;
+    if(wake && m_pipelined_fd >= 0 && write(m_pipelined_fd, &one, sizeof(one)) != sizeof(one)){
+        LOG_ERROR("close wake error");
+    }
+}
+
+bool Http_Conn::Reclaim(){
+    if(m_tasks.load(std::memory_order_acquire) > 0){
+        return false;
+    }
+    m_closed_mutex.Lock();
+    int sockfd = m_closing_fd;
+    m_closing_fd = -1;
+    m_closed_mutex.unLock();
+    if(sockfd >= 0){
+        close(sockfd);
+    }
+    return true;
+}
+
+void Http_Conn::TakeClosed(std::vector<Http_Conn*>& closed){
+    m_closed_mutex.Lock();
+    closed.insert(closed.end(), m_closed.begin(), m_closed.end());
+    m_closed.clear();
+    m_closed_mutex.unLock();
+}
+
+bool Http_Conn::InitPipelined(Poller* poller){
+    m_pipelined_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_pipelined_fd < 0){
+        LOG_ERROR("pipelined eventfd error");
+        return false;
+    }
+    return poller->Add(m_pipelined_fd, EPOLLIN);
+}
+
+void Http_Conn::FreePipelined(){
+    if(m_pipelined_fd >= 0){
+        close(m_pipelined_fd);
+        m_pipelined_fd = -1;
+    }
+}
+
+//连接放进列表后可能被定时器关闭，关闭的连接要到下一轮才回收，所以这时对象还没被复用，用generation再确认一次
+void Http_Conn::TakePipelined(std::vector<Http_Conn*>& conns){
+    uint64_t count;
+    while(read(m_pipelined_fd, &count, sizeof(count)) > 0) {}
+    std::vector<std::pair<Http_Conn*, unsigned int>> pending;
+    m_closed_mutex.Lock();
+    pending.swap(m_pipelined);
+    m_closed_mutex.unLock();
+    for(const auto& item : pending){
+        if(item.first->m_sockfd != -1 && item.first->m_generation == item.second){
+            conns.push_back(item.first);
+        }
     }
 }
 
 //循环读取客户内容，直到无可读，或者对方关闭连接
+//一次没有读满说明内核里的数据已经取完了，不再多读一次等EAGAIN
+//万一之后又到了数据，一次性事件重新注册时内核会检查，已经可读就马上再触发，不会漏掉
 bool Http_Conn::Read(){
     int saveErrno =0;
+    m_idle = false;
     while(1){
-        ssize_t bytes_read = m_read_buffer.ReadFd(m_sockfd,&saveErrno);
+        size_t room = 0;
+        ssize_t bytes_read = m_read_buffer.ReadFd(m_sockfd,&saveErrno,&room);
         if(bytes_read< 0){
             if(saveErrno==EAGAIN || saveErrno == EWOULDBLOCK){
                 break;//代表ET情况下读完了，就停止读取
@@ -87,61 +264,171 @@ bool Http_Conn::Read(){
             return false;
         }else if(bytes_read == 0){
             return false;//读到关闭连接，直接return false,主线程也会关闭连接
+        }else if(static_cast<size_t>(bytes_read) < room){
+            break;
         }
     }
     return true;
 }
 
+//url是不是s，忽略大小写，url不以\0结尾
+static bool UrlIs(const char* url, size_t len, const char* s){
+    return len == strlen(s) && strncasecmp(url, s, len) == 0;
+}
+
+//分类和Do_Request中的判断保持一致，请求行不完整或者不合法的都算静态请求，工作线程很快就能处理完
+Http_Conn::LANE Http_Conn::Classify(){
+    if(m_hot->check_state != CHECK_STATE_REQUESTLINE){
+        return m_lane;//请求头或者请求体还没读完，还是同一个请求
+    }
+    m_lane = LANE_STATIC;
+    const char* begin = m_read_buffer.Peek();
+    const char* end = m_read_buffer.BeginWriteConst();
+    const char* lineEnd = std::search(begin, end, CRLF, CRLF + 2);
+    if(lineEnd == end){
+        return m_lane;
+    }
+    const char* url = std::find(begin, lineEnd, ' ');
+    if(url == lineEnd){
+        return m_lane;
+    }
+    METHOD method;
+    if(UrlIs(begin, url - begin, "GET")){
+        method = GET;
+    }else if(UrlIs(begin, url - begin, "POST")){
+        method = POST;
+    }else{
+        return m_lane;
+    }
+    ++url;
+    const char* urlEnd = std::find(url, lineEnd, ' ');
+    if(urlEnd - url > 7 && strncasecmp(url, "http://", 7) == 0){
+        url = std::find(url + 7, urlEnd, '/');
+    }
+    //和Do_Request用同一张路由表，没有注册的POST是登陆
+    size_t pathLen = std::find(url, urlEnd, '?') - url;
+    const HttpRouter::Route* route = Routes().Match(method, url, pathLen);
+    if(route == nullptr){
+        m_lane = method == POST ? LANE_DB : LANE_STATIC;
+        return m_lane;
+    }
+    m_lane = static_cast<LANE>(route->lane);
+    //文件列表和删除要先登陆，没有会话cookie的只会拿到登陆页面；请求头不完整时还按原来的线程池算
+    if(route->handler == &Http_Conn::Do_File_List || route->handler == &Http_Conn::Do_Delete){
+        const char* headEnd = std::search(lineEnd, end, "\r\n\r\n", "\r\n\r\n" + 4);
+        const char* key = "sessionid=";
+        if(headEnd != end && std::search(lineEnd, headEnd, key, key + 10) == headEnd){
+            m_lane = LANE_STATIC;
+        }
+    }
+    return m_lane;
+}
+
 //写函数，由主线程调用，当process_write生成响应完成后，主线程调用write写出去
 bool Http_Conn::Write(){//返回true就不关闭连接，返回false关闭连接
-    if ( m_bytes_to_send == 0 ) {
+    if ( m_hot->bytes_to_send == 0 ) {
         // 将要发送的字节为0，这一次响应结束。
-        Modfd( m_epollfd, m_sockfd, EPOLLIN ); 
+        Modfd( m_poller, m_sockfd, EPOLLIN ); 
         Clean();
+        m_idle = true;
         return true;
     }
+    EgressScheduler* egress = EgressScheduler::Instance();
+    //大文件交给发送调度，按配额分片发送，连接的关闭也由调度处理
+    if(egress->Shaping(m_hot->bytes_to_send)){
+        egress->Enqueue(this, m_address);
+        return true;
+    }
+    int sent = 0;
+    WRITE_RESULT ret = Write_Some(INT_MAX, sent);
+    if(egress->IsOpen()){
+        egress->Charge(m_address, sent);
+    }
+    return ret == WRITE_DONE || ret == WRITE_BLOCKED;
+}
+
+Http_Conn::WRITE_RESULT Http_Conn::Write_Some(int limit, int &sent){
+    sent = 0;
+    //客户端流水线发来了下一个请求时，这个响应最后不满一个报文段的部分先留在内核里，和下一个响应合在一起发
+    bool more = m_coalesce && m_hot->linger && Has_Pipelined();
     while(1) {
-        // 一起写
-        int temp = writev(m_sockfd, m_iv, m_iv_count);
+        if(limit <= 0){
+            return WRITE_PARTIAL;
+        }
+        //只发limit个字节时，把iv的长度截短，iv本身不动
+        struct iovec iv[2];
+        int left = limit;
+        for(int i = 0; i < m_hot->iv_count; ++i){
+            iv[i] = m_hot->iv[i];
+            if(iv[i].iov_len > (size_t)left){
+                iv[i].iov_len = left;
+            }
+            left -= iv[i].iov_len;
+        }
+        // 一起写，和writev一样，只是可以带上MSG_MORE
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iv;
+        msg.msg_iovlen = m_hot->iv_count;
+        int flags = more && limit >= m_hot->bytes_to_send ? MSG_MORE : 0;
+        int temp = sendmsg(m_sockfd, &msg, flags);
         if ( temp <= -1 ) {
             // EAGAIN 或 EWOULDBLOCK，表示缓冲区已满
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
-                Modfd( m_epollfd, m_sockfd, EPOLLOUT );
-                return true;
+                //之后每次可写时只能写进去一部分，打开TCP_CORK让内核只发满的报文段，不发一堆小包
+                if(m_coalesce && !m_hot->corked){
+                    int on = 1;
+                    setsockopt(m_sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+                    m_hot->corked = true;
+                }
+                Modfd( m_poller, m_sockfd, EPOLLOUT );
+                return WRITE_BLOCKED;
             }
             LOG_ERROR("writev() error");
             unMap();
-            return false;
+            return WRITE_ERROR;
         }
+        sent += temp;
+        limit -= temp;
+        m_hot->held = flags & MSG_MORE;//不带MSG_MORE的发送会把之前留着的数据一起发出去
         //如果写成功一部分，记录还需要写多少
-        m_bytes_to_send -= temp;
-        m_bytes_have_send += temp;
+        m_hot->bytes_to_send -= temp;
+        m_hot->bytes_have_send += temp;
         //如果写完了
-        if ( m_bytes_to_send <= 0 ) {
+        if ( m_hot->bytes_to_send <= 0 ) {
             // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
             unMap();
-            if(m_linger) {//如果要求继续连接
+            if(m_hot->corked && !m_hot->held){
+                Flush_Held();//响应发完了，后面没有要合并的响应
+            }
+            if(m_hot->linger) {//如果要求继续连接
                 Clean();
-                Modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return true;
+                //读缓冲区里还有流水线发来的请求，可读事件不会再触发，交给主线程按请求的种类放回线程池
+                if(m_read_buffer.ReadableBytes() > 0 && m_pipelined_fd >= 0){
+                    Hand_To_Main();
+                    return WRITE_DONE;
+                }
+                m_idle = true;
+                Modfd( m_poller, m_sockfd, EPOLLIN );
+                return WRITE_DONE;
             } else {
-                Modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return false;
+                return WRITE_CLOSE;//调用者马上会关闭连接，不用再注册读事件
             } 
         }
         //注意因为用的不是写缓存中的发送，所以写缓存中的读指针始终不变，而写指针因为已经不再往写缓存里写，所以也位置不变
         //如果没写完,循环下次发送的时候，需要把发送内容修改一下，已发过的就不要再发了
-        if(m_bytes_have_send>=m_write_buffer.ReadableBytes())
+        if(static_cast<size_t>(m_hot->bytes_have_send)>=m_write_buffer.ReadableBytes())
         //但是写缓冲区写完了,总体没写完但写缓冲区写完说明一定发送的文件，就需要把文件已发送的部分也去掉
         {
-            m_iv[0].iov_len=0;
-            m_iv[1].iov_base = m_file_address + (m_bytes_have_send - m_write_buffer.ReadableBytes());
-            m_iv[1].iov_len = m_bytes_to_send;
+            m_hot->iv[0].iov_len=0;
+            //响应体可能是映射的文件，也可能是内存中生成的页面，直接在第二个元素上往后挪
+            m_hot->iv[1].iov_base = static_cast<char*>(m_hot->iv[1].iov_base) + (m_hot->iv[1].iov_len - m_hot->bytes_to_send);
+            m_hot->iv[1].iov_len = m_hot->bytes_to_send;
         }else{//如果写缓冲区没写完，那就不好判断到底有没有文件，不过也不需要涉及到文件了，只用修改第一个元素即可
-            m_iv[0].iov_base = m_write_buffer.Peek()+ m_bytes_have_send;
-            m_iv[0].iov_len=m_iv[0].iov_len - temp;  
+            m_hot->iv[0].iov_base = m_write_buffer.Peek()+ m_hot->bytes_have_send;
+            m_hot->iv[0].iov_len=m_hot->iv[0].iov_len - temp;  
         }
     }
 }
@@ -152,11 +439,54 @@ bool Http_Conn::Write(){//返回true就不关闭连接，返回false关闭连接
 //------------------------------------------------------------------------------
 
 //子线程调用的任务
-void Http_Conn::Process(){//proactor模式下，是把任务中读到的数据进行解析，然后决定发送什么数据，并注册可写，等可写时主线程就会写出去
+void Http_Conn::Process(){
+    Process_();
+    //这次任务做完了，之后主线程才能关掉套接字、回收对象，这里之后不能再碰这个对象
+    Release();
+}
+
+void Http_Conn::Process_(){//proactor模式下，是把任务中读到的数据进行解析，然后决定发送什么数据，并注册可写，等可写时主线程就会写出去
+    //反应堆模式下读写也在这里做，一次性事件还没有重新注册，连接由这个工作线程独占
+    if(m_io_task != TASK_PROCESS){
+        IO_TASK task = m_io_task;
+        m_io_task = TASK_PROCESS;
+        if(task == TASK_WRITE){
+            Worker_Write();
+            return;
+        }
+        if(!Read()){
+            Close_Conn();
+            return;
+        }
+        //读任务都放在静态页面的线程池，读到的是登陆注册、上传这些慢请求时交给主线程放到对应的线程池，
+        //不在这里占着静态页面的线程
+        if(Classify() != LANE_STATIC && m_pipelined_fd >= 0){
+            Hand_To_Main();
+            return;
+        }
+    }
     //把读缓冲区的东西拿出来，解析http请求,解析结束后会有一个返回值，是解析后的结果
-    HTTP_CODE read_ret =  Process_Read();
+#ifdef USE_COROUTINE
+    //协程模式下不管是读到数据、数据库结果回来还是定时器到期，都是从协程上次挂起的地方接着执行
+    if(m_task.Valid()){
+        m_task.Resume();
+        return;
+    }
+#endif
+    HTTP_CODE read_ret;
+    if(m_async_done){//异步数据库的结果回来了，请求已经解析过，直接从登陆注册的结果接着处理
+        m_async_done = false;
+        read_ret = Verify_Result(m_async_ok, strcasecmp(m_url.c_str(),"/register.html") != 0);
+    }else{
+        read_ret = Process_Read();
+    }
     if(read_ret == NO_REQUEST){//说明不完整，需要继续读，而继续读需要重新oneshot
-        Modfd(m_epollfd,m_sockfd,EPOLLIN);
+        Flush_Held();
+        Modfd(m_poller,m_sockfd,EPOLLIN);
+        return;
+    }
+    if(read_ret == ASYNC_REQUEST){//等数据库的结果，既不注册读也不注册写，结果回来后会重新放回线程池
+        Flush_Held();
         return;
     }
     //如果完整，就需要响应，通过返回的解析结果判断是回复正确信息还是回复错误信息
@@ -167,11 +497,65 @@ void Http_Conn::Process(){//proactor模式下，是把任务中读到的数据
         return;
     }
     //如果生成响应成功，就需要写
-    Modfd(m_epollfd,m_sockfd,EPOLLOUT);
+    //套接字几乎总是可写的，先在工作线程直接发，发不完才注册可写事件交给主线程，小响应省掉一轮事件循环
+    if(Direct_Write()){
+        return;
+    }
+    Modfd(m_poller,m_sockfd,EPOLLOUT);
     return;
     
 }
 
+//连接现在由这个工作线程独占，一次性事件还没有重新注册，主线程不会同时读写它
+//Write_Some发完或者写不进去时会注册下一个事件，之后连接就交回主线程了，不能再碰它
+bool Http_Conn::Direct_Write(){
+    //发送调度和它的统计只在主线程使用，开着时还是由主线程发送
+    if(!m_direct_write.load(std::memory_order_relaxed) || EgressScheduler::Instance()->IsOpen()){
+        return false;
+    }
+    Worker_Write();
+    return true;
+}
+
+void Http_Conn::Worker_Write(){
+    int sent = 0;
+    WRITE_RESULT ret = Write_Some(INT_MAX, sent);
+    if(ret == WRITE_CLOSE || ret == WRITE_ERROR){
+        Close_Conn();
+    }
+}
+
+//线程池的Append只能由主线程调用，列表原来是空的时才需要唤醒主线程
+void Http_Conn::Hand_To_Main(){
+    m_closed_mutex.Lock();
+    bool wake = m_pipelined.empty();
+    m_pipelined.push_back(std::make_pair(this, m_generation));
+    m_closed_mutex.unLock();
+    uint64_t one = 1;
+    if(wake && write(m_pipelined_fd, &one, sizeof(one)) != sizeof(one)){
+        LOG_ERROR("pipelined wake error");
+    }
+}
+
+//POST可能还要等请求体，登陆注册要查数据库，都不算马上就有的响应
+bool Http_Conn::Has_Pipelined() const{
+    const char* begin = m_read_buffer.Peek();
+    const char* end = m_read_buffer.BeginWriteConst();
+    const char* headEnd = "\r\n\r\n";
+    return end - begin > 4 && strncmp(begin, "GET ", 4) == 0 && std::search(begin, end, headEnd, headEnd + 4) != end;
+}
+
+//关掉TCP_CORK时内核会把还没发的数据都推出去，MSG_MORE留着的也一样
+void Http_Conn::Flush_Held(){
+    if(!m_hot->corked && !m_hot->held){
+        return;
+    }
+    int off = 0;
+    setsockopt(m_sockfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    m_hot->corked = false;
+    m_hot->held = false;
+}
+
 
 
 //------------------------------------------------------------------------------
@@ -180,12 +564,12 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Read(){
     LINE_STATUS line_status = LINE_OK;
     char* lineEnd =nullptr;
     
-    while( ((m_check_state==CHECK_STATE_CONTENT)&& line_status ==LINE_OK )  || ((line_status = Parse_Line(lineEnd))==LINE_OK)   )
+    while( ((m_hot->check_state==CHECK_STATE_CONTENT)&& line_status ==LINE_OK )  || ((line_status = Parse_Line(lineEnd))==LINE_OK)   )
     //不是请求体时必须要有一行完整数据才能去解析数据，否则结束循环，会返回NO_REQUEST
     //如果需要判断请求体，请求体中不再是一行行的，所以如果状态为请求体，并且请求体之前判断的line_status=LINE_OK，也就能继续进行
     {
         //解析到完整的一行,从peek开始，不用取，直接用
-        switch (m_check_state)
+        switch (m_hot->check_state)
         {
         case CHECK_STATE_REQUESTLINE:
             {
@@ -260,8 +644,6 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Request_Line(char* text)
     //依次检验字符串 str1 中的字符，当被检验字符在字符串 str2 中也包含时，则停止检验，并返回该字符位置,这里检查的是空格和tab符
     char* url_start = strpbrk(text," \t");
     if(!url_start){
-        //为了让后面比较版本的时候不出现段错误，所以要给版本赋个值
-        m_version = std::string("HTTP/1.1");
         return BAD_REQUEST;
     }
     *url_start++='\0';
@@ -273,21 +655,18 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Request_Line(char* text)
         m_mehtod = POST;
     }
     else{
-        //否则就是不支持的命令，但是为了让后面比较版本的时候不出现段错误，所以要给版本赋个值
-        m_version = std::string("HTTP/1.1");
+        //否则就是不支持的命令，回复的状态行用默认的HTTP1.1
         return BAD_REQUEST;
     }
 
     char* version_start = strpbrk(url_start," \t");
     if(!version_start){
-        //为了让后面比较版本的时候不出现段错误，所以要给版本赋个值
-        m_version = std::string("HTTP/1.1");
         return BAD_REQUEST;
     }
 
-    *version_start++='\0';//m_version直接指向写缓存里的地址
-    m_version = std::string(version_start);
-    if(strcasecmp(m_version.c_str(),"HTTP/1.1") != 0 && strcasecmp(m_version.c_str(),"HTTP/1.0") != 0 ){
+    *version_start++='\0';//version_start直接指向读缓存里的地址
+    m_http10 = strcasecmp(version_start,"HTTP/1.0") == 0;
+    if(!m_http10 && strcasecmp(version_start,"HTTP/1.1") != 0 ){
         return BAD_REQUEST;
     }
 
@@ -304,7 +683,7 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Request_Line(char* text)
     if(m_url.size()==0 || m_url[0] !='/'){
         return BAD_REQUEST;
     }
-    m_check_state = CHECK_STATE_HEADER;
+    m_hot->check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
 
@@ -316,7 +695,7 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Headers(char* text)
         // 如果HTTP请求有消息体，则还需要读取m_content_length字节的消息体，
         // 状态机转移到CHECK_STATE_CONTENT状态
         if ( m_content_length != 0 ) {
-            m_check_state = CHECK_STATE_CONTENT;
+            m_hot->check_state = CHECK_STATE_CONTENT;
             return NO_REQUEST;
         }
         // 否则说明我们已经得到了一个完整的HTTP请求
@@ -326,7 +705,7 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Headers(char* text)
         text += 11;
         text += strspn( text, " \t" );//检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标。
         if ( strcasecmp( text, "keep-alive" ) == 0 ) {
-            m_linger = true;
+            m_hot->linger = true;
         }
     } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
         // 处理Content-Length头部字段
@@ -346,6 +725,14 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Headers(char* text)
             boundary+=11;
             m_boundary = std::string(boundary);
         }
+    }else if( strncasecmp( text, "Cookie:", 7 ) == 0){
+        //Cookie: a=b; sessionid=xxx，只关心会话id
+        text += 7;
+        char* sid = strstr(text, "sessionid=");
+        if(sid){
+            sid += 10;
+            m_session = std::string(sid, strcspn(sid, "; \t"));
+        }
     }else {
         //如果是其他头部字段，先不管
     }
@@ -367,137 +754,139 @@ Http_Conn::HTTP_CODE Http_Conn::Process_Connect(char* text)
 }
 
 
+//路由表，新加的接口只要在这里加一行，编译期找好没有冲突的哈希，找不到时编译不过
+//lane是请求交给哪个线程池，主线程分类时用，文件列表没有登陆时还是静态页面
+const Http_Conn::HttpRouter& Http_Conn::Routes(){
+    static constexpr HttpRouter::Route routes[] = {
+        HttpRouter::Route(GET, "/download_", true, LANE_STATIC, &Http_Conn::Do_Download),
+        HttpRouter::Route(GET, "/delete_", true, LANE_IO, &Http_Conn::Do_Delete),
+        HttpRouter::Route(GET, "/error.html", false, LANE_STATIC, &Http_Conn::Do_Hidden),
+        //如果是根目录，也返回登陆页面
+        HttpRouter::Route(GET, "/", false, LANE_IO, &Http_Conn::Do_File_List),
+        HttpRouter::Route(GET, "/filelist", false, LANE_IO, &Http_Conn::Do_File_List),
+        HttpRouter::Route(GET, "/filelist.html", false, LANE_IO, &Http_Conn::Do_File_List),
+        HttpRouter::Route(GET, "/file.html", false, LANE_IO, &Http_Conn::Do_File_List),
+        HttpRouter::Route(GET, "/fileitem.html", false, LANE_IO, &Http_Conn::Do_File_List),
+        HttpRouter::Route(POST, "/upload", false, LANE_IO, &Http_Conn::Do_Upload),
+        HttpRouter::Route(POST, "/register.html", false, LANE_DB, &Http_Conn::Do_Register),
+    };
+    static constexpr uint32_t salt = HttpRouter::FindSalt(routes, sizeof(routes) / sizeof(routes[0]));
+    static_assert(salt != 0, "no perfect hash for the routes, enlarge the router");
+    static const HttpRouter router(routes, salt);
+    return router;
+}
+
 //针对解析结果进行回应，但只是一部分，需要进行文件内存映射的都用这个函数处理内存映射，剩余的在process_write里放到写缓存中
 //文件这个不需要放到写缓存中，分开发送
 Http_Conn::HTTP_CODE Http_Conn::Do_Request(){
-    if(m_mehtod==GET){
-        if(strncasecmp( m_url.c_str(), "/download_", 10 ) == 0){//如果是下载
-            m_url[9]='/';//先把_换成/
-            m_isdownload = true;//下载标志设为真
-            int utf8start = m_url.find('%');
-            //有%就认为有汉字的编码,就要把utf8编码转换为汉字
-            if(utf8start != -1){
-                std::string message = std::string("./filedir") +m_url.substr(9,utf8start-9);
-                std::vector<unsigned char> utf8str;
-                int n = m_url.size();
-                for(int i=utf8start;i<n;++i){//把两个字符一组按照16进制解析成一个long型，再变成unsigned char，然后每三个unsigned char就得到了字符代表的汉字
-                    if(m_url[i]=='%'){//代表接下来是%EA这种编码,但注意空格特殊，是%20，只有一个编码，汉字都是三个编码的组合
-                        if(m_url[i+1]=='2' && m_url[i+2]=='0'){
-                            message = message +' ';
-                            i+=2;
-                            continue;
-                        }
-                        utf8str.push_back((unsigned char)strtol(std::string(m_url.c_str()+i+1,m_url.c_str()+i+3).c_str(),nullptr,16));
-                        if(utf8str.size()==3){
-                            utf8str.push_back('\0');
-                            message = message + (char*)&utf8str[0];
-                            utf8str.clear();
-                        }
-                        i+=2;
-                    }else{
-                        message = message + m_url[i];
-                    }
-                }
-                return Map(const_cast<char*>(message.c_str()));
-            }else{//没有汉字，就正常给文件即可
-                std::string message = "./filedir" + m_url.substr(9,m_url.size()-9);
-                return Map(const_cast<char*>(message.c_str()));
-            }
-        }else if(strncasecmp( m_url.c_str(), "/delete_", 8 ) == 0){//如果是删除
-            m_url[7] = '/';//先把_换成/
-            //也要关注有汉字或者没有汉字
-            int utf8start = m_url.find('%');
-            if(utf8start != -1){
-                //有%就认为有汉字的编码,就要把utf8编码转换为汉字
-                std::string message = std::string("./filedir") +m_url.substr(7,utf8start-7);
-                std::vector<unsigned char> utf8str;
-                int n = m_url.size();
-                for(int i=utf8start;i<n;++i){//把两个字符一组按照16进制解析成一个long型，再变成unsigned char，然后每三个unsigned char就得到了字符代表的汉字
-                    if(m_url[i]=='%'){//代表接下来是%EA这种编码
-                        if(m_url[i+1]=='2' && m_url[i+2]=='0'){
-                            message = message +' ';
-                            i+=2;
-                            continue;
-                        }
-                        utf8str.push_back((unsigned char)strtol(std::string(m_url.c_str()+i+1,m_url.c_str()+i+3).c_str(),nullptr,16));
-                        if(utf8str.size()==3){
-                            utf8str.push_back('\0');
-                            message = message + (char*)&utf8str[0];
-                            utf8str.clear();
-                        }
-                        i+=2;
-                    }else{
-                        message = message + m_url[i];
-                    }
-                }
-                remove(message.c_str());//删除文件
-                //返回剩余文件组成的文件列表网页
-                GetFileHtmlPage();
-                char megret[] = {"./resources/file.html"};
-                return Map(megret);
-            }else{//没有汉字，就正常删除文件即可
-                std::string message = "./filedir" + m_url.substr(7,m_url.size()-7);
-                remove(message.c_str());//删除文件
-                //返回剩余文件组成的文件列表网页
-                GetFileHtmlPage();
-                char megret[] = {"./resources/file.html"};
-                return Map(megret);
-            }
-        }else{//是正常的网页申请
-            //直接请求的error.html不允许
-            if(strcasecmp(m_url.c_str(),"/error.html")==0){
-                return NO_RESOURCE;
-            }
-            //并且不能直接进入文件页面，必须先登陆
-            if(strcasecmp(m_url.c_str(),"/")==0 || strcasecmp(m_url.c_str(),"/filelist.html")==0  || 
-            strcasecmp(m_url.c_str(),"/file.html")==0 || strcasecmp(m_url.c_str(),"/fileitem.html")==0){//如果是根目录，也返回登陆页面
-                char message[] = {"./resources/login.html"};
-                return Map(message);//就返回登陆页面
-            }
-            //正常的登陆或者注册页面的申请
-            std::string message = "./resources" + m_url;
-            return Map(const_cast<char*>(message.c_str()));
-
-        }
-    }else if(m_mehtod==POST){
-        if(strcasecmp(m_url.c_str(),"/upload")!=0){//如果不是上传，必然是登陆或者注册
-            ParseFromUrlencoded_();//解析用户名和密码
-            //解析完消息体之后需要把读指针挪到下一个请求行的头部
-            m_read_buffer.RetrieveUntil(m_content_length + m_read_buffer.Peek());
-            bool islogin = true;//默认为登陆
-            if(strcasecmp(m_url.c_str(),"/register.html") == 0)//再一次比较文件名，判断是登陆还是注册
-            {
-                islogin = false;
-            }
-            //根据用户名，密码，去登陆或者注册mysql
-            if(UserVerify(post_["username"],post_["password"], islogin)){
-                //如果成功
-                if(islogin){//登陆成功
-                    //生成要返回的真正文件,并进行内存映射
-                    GetFileHtmlPage();
-                    char message[] = {"./resources/file.html"};
-                    return Map(message);
-                }else{//注册成功
-                    char message[] = {"./resources/login.html"};
-                    return Map(message);//就返回登陆页面
-                }
-            }else{
-                char message[] = {"./resources/error.html"};
-                return Map(message);//两种失败都返回错误界面
-            }
-        }else{//否则说明是文件上传
-            //保存文件
-            Process_File();
-            //解析完文件后要到下个请求行的的头部
-            m_read_buffer.RetrieveUntil(m_content_length + m_read_buffer.Peek());
-            //生成要返回的真正文件,并进行内存映射
-            GetFileHtmlPage();
-            char message[] = {"./resources/file.html"};
-            return Map(message);
+    if(m_mehtod != GET && m_mehtod != POST){
+        return  BAD_REQUEST;
+    }
+    //分页、排序和搜索的参数在url的?后面，路由只看前面的路径
+    size_t pathLen = std::min(m_url.find('?'), m_url.size());
+    const HttpRouter::Route* route = Routes().Match(m_mehtod, m_url.data(), pathLen);
+    if(route != nullptr){
+        return (this->*route->handler)(m_url.c_str() + route->len);
+    }
+    if(m_mehtod == POST){//没有注册的POST必然是登陆
+        return Do_Login(nullptr);
+    }
+    //正常的登陆或者注册页面的申请
+    std::string message = "./resources" + m_url;
+    return Map(const_cast<char*>(message.c_str()));
+}
+
+//url中的文件名，文件列表里的链接把文件名的每个字节都按%XX编码，汉字是几个%XX的组合，这里逐个字节还原
+static std::string DecodeName(const char* name){
+    std::string message;
+    for(const char* p = name; *p; ++p){
+        if(*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])){
+            message += (char)strtol(std::string(p + 1, p + 3).c_str(), nullptr, 16);
+            p += 2;
+        }else{
+            message += *p;
+        }
+    }
+    return message;
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Download(const char* rest){
+    if(!IsLoggedIn()){
+        return Login_Page();
+    }
+    m_isdownload = true;//下载标志设为真
+    std::string message = "./filedir/" + DecodeName(rest);
+    return Map(const_cast<char*>(message.c_str()));
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Delete(const char* rest){
+    if(!IsLoggedIn()){
+        return Login_Page();
+    }
+    //删除文件，去重保存时还要回收没人用的blob
+    std::string name = DecodeName(rest);
+    BlobStore::Instance()->Remove(name);
+    FileIndex::Instance()->Remove(name);
+    //返回剩余文件组成的文件列表网页
+    return FileListPage("");
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Hidden(const char*){
+    //直接请求的error.html不允许
+    return NO_RESOURCE;
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_File_List(const char* rest){
+    //不能直接进入文件页面，必须先登陆，带着有效会话cookie的算已经登陆
+    if(IsLoggedIn()){
+        return FileListPage(*rest == '?' ? rest + 1 : "");
+    }
+    return Login_Page();
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Upload(const char*){
+    //没有登陆时不保存文件，但请求体还是要跳过
+    bool loggedIn = IsLoggedIn();
+    if(loggedIn){
+        Process_File();
+    }
+    //解析完文件后要到下个请求行的的头部
+    m_read_buffer.RetrieveUntil(m_content_length + m_read_buffer.Peek());
+    if(!loggedIn){
+        return Login_Page();
+    }
+    //返回加上新文件的文件列表网页
+    return FileListPage("");
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Login(const char*){
+    return Do_Verify(true);
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Register(const char*){
+    return Do_Verify(false);
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Do_Verify(bool islogin){
+    ParseFromUrlencoded_();//解析用户名和密码
+    //解析完消息体之后需要把读指针挪到下一个请求行的头部
+    m_read_buffer.RetrieveUntil(m_content_length + m_read_buffer.Peek());
+    //根据用户名，密码，去登陆或者注册mysql
+#ifdef USE_COROUTINE
+    //协程模式下由协程去等数据库的结果
+    m_verify_login = islogin;
+    return ASYNC_REQUEST;
+#endif
+    bool ok;
+    if(AsyncSql::Instance()->IsOpen()){
+        //异步数据库开着时，缓存没命中就交给主线程去查，工作线程不用等
+        if(UserVerifyAsync(post_["username"],post_["password"], islogin, ok)){
+            return ASYNC_REQUEST;
         }
     }else{
-        return  BAD_REQUEST;
+        ok = UserVerify(post_["username"],post_["password"], islogin);
     }
+    return Verify_Result(ok, islogin);
 }
 //对登陆和注册的用户名密码进行解析
 void Http_Conn::ParseFromUrlencoded_() {
@@ -532,41 +921,139 @@ void Http_Conn::ParseFromUrlencoded_() {
         post_[key] = value;
     }
 }
+//登陆注册的结果已经知道了，决定返回哪个页面
+Http_Conn::HTTP_CODE Http_Conn::Verify_Result(bool ok, bool isLogin){
+    if(ok){
+        //如果成功
+        if(isLogin){//登陆成功
+            //建立会话，之后的页面请求带着cookie就不用再登陆了
+            m_set_cookie = SessionManager::Instance()->Create(post_["username"]);
+            //返回文件列表网页
+            return FileListPage("");
+        }else{//注册成功
+            char message[] = {"./resources/login.html"};
+            return Map(message);//就返回登陆页面
+        }
+    }else{
+        char message[] = {"./resources/error.html"};
+        return Map(message);//两种失败都返回错误界面
+    }
+}
+
+bool Http_Conn::CheckAuthCache(const std::string &name, const std::string &pwd, bool isLogin, bool &result) {
+    //命中就不用占用数据库连接
+    AuthCache::RESULT cached = AuthCache::Instance()->Check(name, pwd);
+    if(cached == AuthCache::MISS) {
+        return false;
+    }
+    LOG_DEBUG("auth cache hit: %d", cached);
+    if(isLogin) {
+        result = cached == AuthCache::MATCH;
+        return true;
+    }
+    if(cached != AuthCache::NO_USER) {
+        result = false;//注册时缓存中已经有这个用户，不能再注册
+        return true;
+    }
+    return false;//注册一个缓存里不存在的用户，还是要去数据库插入
+}
+
+bool Http_Conn::UserVerifyAsync(const std::string &name, const std::string &pwd, bool isLogin, bool &result) {
+    if(name == "" || pwd == "") {
+        result = false;
+        return false;
+    }
+    LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+    if(CheckAuthCache(name, pwd, isLogin, result)) {
+        return false;
+    }
+    //回调在主线程执行，连接如果在等待期间被关闭甚至被新客户复用，generation就对不上了
+    Http_Conn* conn = this;
+    unsigned int generation = m_generation;
+    AsyncSql::JOB_TYPE type = isLogin ? AsyncSql::JOB_LOGIN : AsyncSql::JOB_REGISTER;
+    if(!AsyncSql::Instance()->Submit(type, name, pwd, [conn, generation](bool ok) {
+            conn->Resume_Verify(generation, ok);
+        })) {
+        result = UserVerify(name, pwd, isLogin);//提交不了就退回同步查询
+        return false;
+    }
+    return true;
+}
+
+void Http_Conn::Resume_Verify(unsigned int generation, bool ok) {
+    if(generation != m_generation || m_sockfd == -1) {
+        return;//等待期间连接已经关了
+    }
+    m_async_ok = ok;
+    m_async_done = true;
+    if(!m_resume || !m_resume(this)) {
+        Close_Conn();
+    }
+}
+
 //对登陆和注册在一个函数中操作，返回成功与否
 bool Http_Conn::UserVerify(const std::string &name, const std::string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false;}
     LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
+    //先查凭证缓存
+    bool cachedResult;
+    if(CheckAuthCache(name, pwd, isLogin, cachedResult)) {
+        return cachedResult;
+    }
     MYSQL* sql;
     SqlConnRAII raii(&sql,  SqlConnPool::Instance());//从sql连接池中拿出来一个sql连接使用,析构后会自动放回去
-    assert(sql);
+    if(!sql) {//等待超时也没拿到连接
+        LOG_WARN("no sql connection for %s", name.c_str());
+        return false;
+    }
 
     bool flag = false;
-    char order[256] = { 0 };
-    MYSQL_RES *res = nullptr;
+    bool found = false;//数据库中是否有这个用户
     //如果是注册，先标志为true
     if(!isLogin) { flag = true; }
-    //先生成查询语句，根据用户名去查询对应的用户名和密码
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());//order 及查询语句
-    LOG_DEBUG("%s", order);
+    //用连接上缓存的预编译语句查询，用户名作为参数绑定进去，不再拼接sql，既省去了数据库每次解析sql，也避免了注入
+    MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, SqlConnPool::STMT_LOGIN);
+    if(!stmt) { return false; }
+
+    unsigned long nameLen = name.size();
+    MYSQL_BIND param[1];
+    memset(param, 0, sizeof(param));
+    param[0].buffer_type = MYSQL_TYPE_STRING;
+    param[0].buffer = const_cast<char*>(name.data());
+    param[0].buffer_length = nameLen;
+    param[0].length = &nameLen;
 
-    //mysql_query函数查询，如果查询失败，返回false，找到值和没找到值都算查询成功
-    //查询加个读锁
+    char password[PASSWORD_LEN] = { 0 };
+    unsigned long passwordLen = 0;
+    MYSQL_BIND result[1];
+    memset(result, 0, sizeof(result));
+    result[0].buffer_type = MYSQL_TYPE_STRING;
+    result[0].buffer = password;
+    result[0].buffer_length = PASSWORD_LEN;
+    result[0].length = &passwordLen;
+
+    //查询加个读锁，找到值和没找到值都算查询成功，失败就把语句丢掉，下次重新prepare
     rwlock.rdLock();
-    if(mysql_query(sql, order)) {
-        mysql_free_result(res);
-        return false; 
+    if(mysql_stmt_bind_param(stmt, param) || mysql_stmt_execute(stmt) ||
+       mysql_stmt_bind_result(stmt, result) || mysql_stmt_store_result(stmt)) {
+        LOG_ERROR("login stmt error: %s", mysql_stmt_error(stmt));
+        rwlock.unLock();
+        SqlConnPool::Instance()->ResetStmt(sql, SqlConnPool::STMT_LOGIN);
+        return false;
     }
     rwlock.unLock();
 
-    res = mysql_store_result(sql);//再把结束放入res
-    //从结果集中取得一行数据返回
-    //进入循环说明存在对应的用户名，如果是登陆，密码正确就返回true，否则返回false，如果是注册，就不能注册了，也要返回false
-    //取不出来返回null，说明不存在这样的用户，如果是登陆，跳过循环以及注册，直接会返回false，如果是注册就要去注册，成功返回true，失败返回false;
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        std::string password(row[1]);
-        if(isLogin) {//如果是登陆，判断密码是否正确
-            if(pwd == password) { flag = true; }
+    //从结果集中取得一行数据
+    //取到说明存在对应的用户名，如果是登陆，密码正确就返回true，否则返回false，如果是注册，就不能注册了，也要返回false
+    //取不出来说明不存在这样的用户，如果是登陆，直接会返回false，如果是注册就要去注册，成功返回true，失败返回false;
+    int ret;
+    while((ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED) {
+        LOG_DEBUG("MYSQL ROW: %s %s", name.c_str(), password);
+        found = true;
+        //把数据库里的密码放入缓存，下次同一个用户登陆就不用查库了，被截断的密码不缓存
+        if(ret == 0) { AuthCache::Instance()->Put(name, std::string(password, passwordLen)); }
+        if(isLogin) {//如果是登陆，判断密码是否正确，被截断的密码一定不会相等
+            if(ret == 0 && pwd == std::string(password, passwordLen)) { flag = true; }
             else {
                 flag = false;
                 LOG_DEBUG("pwd error!");
@@ -577,28 +1064,51 @@ bool Http_Conn::UserVerify(const std::string &name, const std::string &pwd, bool
             LOG_DEBUG("user used!");
         }
     }
-    mysql_free_result(res);
+    mysql_stmt_free_result(stmt);
+    if(!found) {
+        AuthCache::Instance()->PutNoUser(name);
+    }
     /* 注册行为 且 用户名未被使用*/
     //之前只有用户名找不到，无法进入循环，才能进入这里，否则进不去，也就注册不了
     if(!isLogin && flag == true) {
         LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
+        MYSQL_STMT* insertStmt = SqlConnPool::Instance()->GetStmt(sql, SqlConnPool::STMT_REGISTER);
+        if(!insertStmt) { return false; }
+        unsigned long pwdLen = pwd.size();
+        MYSQL_BIND insertParam[2];
+        memset(insertParam, 0, sizeof(insertParam));
+        insertParam[0] = param[0];
+        insertParam[1].buffer_type = MYSQL_TYPE_STRING;
+        insertParam[1].buffer = const_cast<char*>(pwd.data());
+        insertParam[1].buffer_length = pwdLen;
+        insertParam[1].length = &pwdLen;
         //加写锁
         rwlock.wrLock();
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
+        if(mysql_stmt_bind_param(insertStmt, insertParam) || mysql_stmt_execute(insertStmt)) { 
+            LOG_DEBUG( "Insert error: %s", mysql_stmt_error(insertStmt));
+            SqlConnPool::Instance()->ResetStmt(sql, SqlConnPool::STMT_REGISTER);
             flag = false; //注册失败
         }else{
             flag = true;//注册成功
         }
         rwlock.unLock();
+        //插入了新用户，之前的负缓存要失效
+        AuthCache::Instance()->Invalidate(name);
     }
     LOG_DEBUG( "UserVerify success!!");
     return flag;
 }
 
+//只查内存中的会话表，不访问数据库
+bool Http_Conn::IsLoggedIn(){
+    return !m_session.empty() && SessionManager::Instance()->Validate(m_session);
+}
+
+Http_Conn::HTTP_CODE Http_Conn::Login_Page(){
+    char message[] = {"./resources/login.html"};
+    return Map(message);
+}
+
 //解析消息体中的文件，并保存文件
 void Http_Conn::Process_File(){
     //跳过文件的开始行
@@ -631,70 +1141,201 @@ void Http_Conn::Process_File(){
     if(!body)return;
     body+=4;//跳过空行，指向文件正文的第一个
     if(*body =='\r')return;
-    //打开文件
-    std::ofstream ofs("./filedir/" + file_name, std::ios::out  | std::ios::binary);//不要加 std::ios::app，追加模式如果多次传同一个文件，会被保存在同一个文件中
     //知道文件内容结束后增加的长度
     long end_length = m_boundary.size()+8;//文件结束行长度再加上上一行的\r\n,这个文件内容最后一行的\r\n是自动添加的，不能算文件内容
     //找到文件结束的下一个字符
     char* body_end = m_read_buffer.Peek()+m_content_length-end_length;//指向文件结束后自动添加的\r
     long segment_length = body_end-body;
-    ofs.write(body,segment_length);
-    ofs.close();
+    //保存文件，同名文件直接替换；打开去重时相同内容只保存一份
+    if(segment_length < 0 || !BlobStore::Instance()->Save(file_name, body, segment_length)){
+        LOG_ERROR("save upload %s error", file_name.c_str());
+        return;
+    }
+    //新文件或者覆盖后的大小、时间放进目录索引
+    FileIndex::Instance()->Update(file_name);
 }
 
-// 以下两个函数用来构建文件列表的页面，最终结果生成file文件保存
-void Http_Conn::GetFileHtmlPage(){
+//文件列表页面的模板按两个标记分成三段，第一次用到时读一次，之后直接拼接
+static const std::vector<std::string>& FileListTemplate(){
+    static const std::vector<std::string> parts = []() {
+        std::vector<std::string> res(1);
+        std::ifstream fileListStream(std::string("./resources")+"/filelist.html", std::ios::in);
+        std::string tempLine;
+        while(getline(fileListStream, tempLine)){
+            if(tempLine == "<!--filelist_label-->" || tempLine == "<!--pagination_label-->"){
+                res.push_back("");
+                continue;
+            }
+            res.back() += tempLine + "\n";
+        }
+        res.resize(3);
+        return res;
+    }();
+    return parts;
+}
 
-    // 将指定目录内的所有文件保存到 fileVec 中
-    std::vector<std::string> fileVec;
-    GetFileVec("./filedir", fileVec);
-    std::ifstream fileListStream(std::string("./resources")+"/filelist.html", std::ios::in);
-    std::ofstream ofs(std::string("./resources")+"/file.html", std::ios::out  | std::ios::binary);
-    std::string tempLine;
-    // 首先读取文件列表的 <!--filelist_label--> 注释前的语句,放入新的文件中
-    while(1){
-        getline(fileListStream, tempLine);
-        if(tempLine == "<!--filelist_label-->"){
-            break;
+//url参数中的%XX和+还原成原来的字符
+static std::string UrlDecode(const std::string &str){
+    std::string res;
+    for(size_t i = 0; i < str.size(); ++i){
+        if(str[i] == '+'){
+            res.push_back(' ');
+        }else if(str[i] == '%' && i + 2 < str.size() && isxdigit((unsigned char)str[i+1]) && isxdigit((unsigned char)str[i+2])){
+            res.push_back((char)strtol(str.substr(i+1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }else{
+            res.push_back(str[i]);
         }
-        ofs << tempLine << "\n";
     }
-    // 根据如下标签，将将文件夹中的所有文件项添加到返回页面中
-    //             <tr><td class="col1">filename</td> <td class="col2"><a href="download_filename">下载</a></td> <td class="col3"><a href="delete_filename">删除</a></td></tr>
-    for(const auto &filename : fileVec){
-        ofs << "            <tr><td class=\"col1\">" + filename +
-                    "</td> <td class=\"col2\"><a href=\"download_" + filename +
-                    "\">下载</a></td> <td class=\"col3\"><a href=\"delete_" + filename +
-                    "\" onclick=\"return confirmDelete();\">删除</a></td></tr>" + "\n";
+    return res;
+}
+
+static std::string UrlEncode(const std::string &str){
+    static const char hex[] = "0123456789ABCDEF";
+    std::string res;
+    for(unsigned char ch : str){
+        if(isalnum(ch) || ch == '-' || ch == '_' || ch == '.' || ch == '~'){
+            res.push_back(ch);
+        }else{
+            res.push_back('%');
+            res.push_back(hex[ch >> 4]);
+            res.push_back(hex[ch & 15]);
+        }
     }
-    // 将文件列表注释后的语句加入后面
-    while(getline(fileListStream, tempLine)){
-        ofs << tempLine + "\n";
+    return res;
+}
+
+//搜索词会原样显示在页面里，要转义
+static std::string HtmlEscape(const std::string &str){
+    std::string res;
+    for(char ch : str){
+        switch(ch){
+            case '<': res += "&lt;"; break;
+            case '>': res += "&gt;"; break;
+            case '&': res += "&amp;"; break;
+            case '"': res += "&quot;"; break;
+            default: res.push_back(ch); break;
+        }
     }
-    
+    return res;
 }
-void Http_Conn::GetFileVec(const std::string dirName, std::vector<std::string> &resVec){
-    // 使用 dirent 获取文件目录下的所有文件
-    DIR *dir;   // 目录指针
-    dir = opendir(dirName.c_str());
-    struct dirent *stdinfo;
-    while (1)
-    {
-        // 获取文件夹中的一个文件
-        stdinfo = readdir(dir);
-        if (stdinfo == nullptr){
-            break;
+
+// 根据目录索引生成文件列表的一页，页面放在m_content中，不再写到file.html
+// 参数: page页码 size每页个数 sort=name|size|mtime order=asc|desc q搜索词 match=prefix|substr
+Http_Conn::HTTP_CODE Http_Conn::FileListPage(const std::string &query){
+    FileIndex::Query q;
+    std::string sortName = "name";
+    size_t start = 0;
+    while(start < query.size()){
+        size_t end = query.find('&', start);
+        if(end == std::string::npos){
+            end = query.size();
+        }
+        size_t eq = query.find('=', start);
+        if(eq != std::string::npos && eq < end){
+            std::string key = query.substr(start, eq - start);
+            std::string value = UrlDecode(query.substr(eq + 1, end - eq - 1));
+            if(key == "page"){
+                q.page = atoi(value.c_str());
+            }else if(key == "size"){
+                q.pageSize = atoi(value.c_str());
+            }else if(key == "sort"){
+                if(value == "size"){
+                    q.sort = FileIndex::SORT_SIZE;
+                    sortName = value;
+                }else if(value == "mtime"){
+                    q.sort = FileIndex::SORT_MTIME;
+                    sortName = value;
+                }
+            }else if(key == "order"){
+                q.desc = (value == "desc");
+            }else if(key == "q"){
+                q.keyword = value;
+            }else if(key == "match"){
+                q.prefix = (value == "prefix");
+            }
         }
-        if(strcasecmp(stdinfo->d_name,".") != 0  && strcasecmp(stdinfo->d_name,"..") != 0 )resVec.push_back(stdinfo->d_name);
+        start = end + 1;
     }
+    if(q.pageSize <= 0 || q.pageSize > FileIndex::MAX_PAGE_SIZE){
+        q.pageSize = FileIndex::DEFAULT_PAGE_SIZE;
+    }
+    if(q.page < 1){
+        q.page = 1;
+    }
+    std::vector<FileIndex::Entry> entries;
+    size_t total = FileIndex::Instance()->List(q, entries);
+    int pageNum = total == 0 ? 1 : (int)((total + q.pageSize - 1) / q.pageSize);
+
+    const std::vector<std::string>& parts = FileListTemplate();
+    m_content = parts[0];
+    // 根据如下标签，将这一页的文件项添加到返回页面中
+    //             <tr><td class="col1">filename</td> <td class="col4">大小</td> <td class="col5">修改时间</td> <td class="col2"><a href="download_filename">下载</a></td> <td class="col3"><a href="delete_filename">删除</a></td></tr>
+    char buf[64];
+    for(const FileIndex::Entry &entry : entries){
+        m_content += "            <tr><td class=\"col1\">" + HtmlEscape(entry.name) + "</td> <td class=\"col4\">";
+        if(entry.size < 1024){
+            snprintf(buf, sizeof(buf), "%lld B", entry.size);
+        }else if(entry.size < 1024LL * 1024){
+            snprintf(buf, sizeof(buf), "%.1f KB", entry.size / 1024.0);
+        }else if(entry.size < 1024LL * 1024 * 1024){
+            snprintf(buf, sizeof(buf), "%.1f MB", entry.size / (1024.0 * 1024));
+        }else{
+            snprintf(buf, sizeof(buf), "%.1f GB", entry.size / (1024.0 * 1024 * 1024));
+        }
+        m_content += buf;
+        m_content += "</td> <td class=\"col5\">";
+        struct tm t;
+        localtime_r(&entry.mtime, &t);
+        strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &t);
+        m_content += buf;
+        //文件名放进链接前先按%XX编码，再按html转义，文件名里的引号和尖括号不会破坏页面
+        std::string href = HtmlEscape(UrlEncode(entry.name));
+        m_content += "</td> <td class=\"col2\"><a href=\"download_" + href +
+                    "\">下载</a></td> <td class=\"col3\"><a href=\"delete_" + href +
+                    "\" onclick=\"return confirmDelete();\">删除</a></td></tr>\n";
+    }
+    m_content += parts[1];
+
+    // 表格下面是搜索框和翻页，翻页的链接带上当前的排序和搜索条件
+    std::string keyword = HtmlEscape(q.keyword);
+    m_content += "         <div style=\"width:600px; margin:10px auto;\">\n"
+                 "             <form action=\"filelist\" method=\"get\">\n"
+                 "                 <input type=\"text\" name=\"q\" value=\"" + keyword + "\" placeholder=\"文件名\"/>\n"
+                 "                 <select name=\"match\"><option value=\"substr\">包含</option><option value=\"prefix\"" +
+                 (q.prefix ? " selected" : "") + ">开头是</option></select>\n"
+                 "                 <select name=\"sort\"><option value=\"name\">按文件名</option><option value=\"size\"" +
+                 (q.sort == FileIndex::SORT_SIZE ? " selected" : "") + ">按大小</option><option value=\"mtime\"" +
+                 (q.sort == FileIndex::SORT_MTIME ? " selected" : "") + ">按修改时间</option></select>\n"
+                 "                 <select name=\"order\"><option value=\"asc\">升序</option><option value=\"desc\"" +
+                 (q.desc ? " selected" : "") + ">降序</option></select>\n"
+                 "                 <input type=\"hidden\" name=\"size\" value=\"" + std::to_string(q.pageSize) + "\"/>\n"
+                 "                 <input type=\"submit\" value=\"查询\"/>\n"
+                 "             </form>\n";
+    std::string link = "filelist?sort=" + sortName + "&amp;order=" + (q.desc ? "desc" : "asc") +
+                       "&amp;size=" + std::to_string(q.pageSize);
+    if(!q.keyword.empty()){
+        link += std::string("&amp;match=") + (q.prefix ? "prefix" : "substr") + "&amp;q=" + UrlEncode(q.keyword);
+    }
+    m_content += "             ";
+    if(q.page > 1){
+        m_content += "<a href=\"" + link + "&amp;page=" + std::to_string(q.page - 1) + "\">上一页</a> ";
+    }
+    m_content += "第 " + std::to_string(q.page) + " / " + std::to_string(pageNum) + " 页，共 " + std::to_string(total) + " 个文件";
+    if(q.page < pageNum){
+        m_content += " <a href=\"" + link + "&amp;page=" + std::to_string(q.page + 1) + "\">下一页</a>";
+    }
+    m_content += "\n         </div>\n";
+    m_content += parts[2];
+    return PAGE_REQUEST;
 }
 
 //把指定的文件夹里的文件进行内存映射
 Http_Conn::HTTP_CODE Http_Conn::Map(char* file){
-        strcpy( m_real_file, file );
+        m_real_file = file;
 
         // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-        if ( stat( m_real_file, &m_file_stat ) < 0 ) {
+        if ( stat( m_real_file.c_str(), &m_file_stat ) < 0 ) {
             return NO_RESOURCE;
         }
         // 判断访问权限
@@ -707,7 +1348,7 @@ Http_Conn::HTTP_CODE Http_Conn::Map(char* file){
         }
 
         // 以只读方式打开文件
-        int fd = open( m_real_file, O_RDONLY );
+        int fd = open( m_real_file.c_str(), O_RDONLY );
         // 创建内存映射
         m_file_address = ( char* )mmap( NULL, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
         close( fd );
@@ -739,15 +1380,17 @@ bool Http_Conn::Process_Write(HTTP_CODE ret){
             if ( ! Add_Content( error_500_form ) ) {
                 return false;
             }
-            m_bytes_to_send = m_write_buffer.ReadableBytes();//因为响应体不是文件而是字符串时，也在写缓存中
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes();//因为响应体不是文件而是字符串时，也在写缓存中
             break;
         case BAD_REQUEST:
+            //不合法的请求还留在读缓冲区里，找不到下一个请求从哪开始，发完就关闭连接
+            m_hot->linger = false;
             Add_Status_Line( 400, error_400_title );
             Add_Headers( strlen( error_400_form ));
             if ( ! Add_Content( error_400_form ) ) {
                 return false;
             }
-            m_bytes_to_send = m_write_buffer.ReadableBytes();
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes();
             break;
         case NO_RESOURCE:
             Add_Status_Line( 404, error_404_title );
@@ -755,7 +1398,7 @@ bool Http_Conn::Process_Write(HTTP_CODE ret){
             if ( ! Add_Content( error_404_form ) ) {
                 return false;
             }
-            m_bytes_to_send = m_write_buffer.ReadableBytes();
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes();
             break;
         case FORBIDDEN_REQUEST:
             Add_Status_Line( 403, error_403_title );
@@ -763,26 +1406,36 @@ bool Http_Conn::Process_Write(HTTP_CODE ret){
             if ( ! Add_Content( error_403_form ) ) {
                 return false;
             }
-            m_bytes_to_send = m_write_buffer.ReadableBytes();
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes();
             break;
         case FILE_REQUEST:
             Add_Status_Line(200, ok_200_title );
             Add_Headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buffer.Peek();
-            m_iv[ 0 ].iov_len = m_write_buffer.ReadableBytes();
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
+            m_hot->iv[ 0 ].iov_base = m_write_buffer.Peek();
+            m_hot->iv[ 0 ].iov_len = m_write_buffer.ReadableBytes();
+            m_hot->iv[ 1 ].iov_base = m_file_address;
+            m_hot->iv[ 1 ].iov_len = m_file_stat.st_size;
+            m_hot->iv_count = 2;
             //需要发送的总字节数
-            m_bytes_to_send = m_write_buffer.ReadableBytes() + m_file_stat.st_size;
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes() + m_file_stat.st_size;
+            return true;
+        case PAGE_REQUEST:
+            Add_Status_Line(200, ok_200_title );
+            Add_Headers(m_content.size());
+            m_hot->iv[ 0 ].iov_base = m_write_buffer.Peek();
+            m_hot->iv[ 0 ].iov_len = m_write_buffer.ReadableBytes();
+            m_hot->iv[ 1 ].iov_base = &m_content[0];
+            m_hot->iv[ 1 ].iov_len = m_content.size();
+            m_hot->iv_count = 2;
+            m_hot->bytes_to_send = m_write_buffer.ReadableBytes() + m_content.size();
             return true;
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buffer.Peek();
-    m_iv[ 0 ].iov_len = m_write_buffer.ReadableBytes();
-    m_iv_count = 1;
+    m_hot->iv[ 0 ].iov_base = m_write_buffer.Peek();
+    m_hot->iv[ 0 ].iov_len = m_write_buffer.ReadableBytes();
+    m_hot->iv_count = 1;
     return true;
 }
 //生成响应需要调用的函数
@@ -804,38 +1457,50 @@ bool Http_Conn::Add_Response(const char* format,...)//往写缓冲中写入数
 
 bool Http_Conn::Add_Status_Line(int status,const char* title)//写入响应行
 {
-    if(strcasecmp(m_version.c_str(),"HTTP/1.0") == 0){
-        return Add_Response( "%s %d %s\r\n", "HTTP/1.0", status, title );
+    for(const auto& item : status_lines){
+        if(item.status == status){
+            const Fragment& line = item.line[m_http10 ? 1 : 0];
+            m_write_buffer.Append(line.data, line.len);
+            return true;
+        }
     }
-    return Add_Response( "%s %d %s\r\n", "HTTP/1.1", status, title );//默认为1.1
-    
-
+    return Add_Response( "%s %d %s\r\n", m_http10 ? "HTTP/1.0" : "HTTP/1.1", status, title );//默认为1.1
 }
 bool Http_Conn::Add_Headers(int content_len)//写入响应头
 {
+    char number[24];
+    char* numberEnd = number + sizeof(number);
+    char* numberBegin = FormatUint(numberEnd, content_len > 0 ? content_len : 0);
+    const Fragment& tail = linger_tail[m_hot->linger ? 1 : 0];
+    //先算出总长度，写缓冲只检查一次空间
+    size_t len = length_header.len + (numberEnd - numberBegin) + tail.len;
     if(m_isdownload){
-        Add_Response( "Content-Disposition: attachment\r\n");//添加这个字段，可以决定客户端的下载还是直接显示
+        len += download_header.len;
+    }
+    if(!m_set_cookie.empty()){
+        len += cookie_begin.len + m_set_cookie.size() + cookie_end.len;
+    }
+    m_write_buffer.EnsureWriteable(len);
+    char* p = m_write_buffer.BeginWrite();
+    if(m_isdownload){//添加这个字段，可以决定客户端的下载还是直接显示
+        p = Put(p, download_header.data, download_header.len);
+    }
+    if(!m_set_cookie.empty()){//登陆成功，把会话id发给客户端
+        p = Put(p, cookie_begin.data, cookie_begin.len);
+        p = Put(p, m_set_cookie.data(), m_set_cookie.size());
+        p = Put(p, cookie_end.data, cookie_end.len);
     }
     //注意如果文件类型和真正类型不一致，会导致客户端的错误
-    return Add_Content_Length(content_len) && Add_Linger() &&  Add_Blank_Line();
-
-}
-bool Http_Conn::Add_Content_Length(int content_len)//响应头中需要写入的响应体长度
-{
-    return Add_Response( "Content-Length: %d\r\n", content_len );
-}
-bool Http_Conn::Add_Linger()//响应头中写入是否保持连接
-{
-    return Add_Response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
-}
-
-bool Http_Conn::Add_Blank_Line()//写入空行
-{
-    return Add_Response( "%s", "\r\n" );
+    p = Put(p, length_header.data, length_header.len);
+    p = Put(p, numberBegin, numberEnd - numberBegin);
+    Put(p, tail.data, tail.len);
+    m_write_buffer.HasWritten(len);
+    return true;
 }
 bool Http_Conn::Add_Content(const char* content)//除了文件以外的如果需要写入其他字符型响应体，用这个函数加到写缓存中
 {
-    return Add_Response( "%s", content );
+    m_write_buffer.Append(content, strlen(content));
+    return true;
 }
 
 
@@ -8,14 +8,18 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include <sys/eventfd.h>
 #include <cstdarg>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <dirent.h>
 
@@ -25,6 +29,9 @@
 #include <unordered_map>
 #include <fstream>
 #include <locale.h>
+#include <functional>
+#include <vector>
+#include <atomic>
 
 #include "../locker/locker.h"
 #include "../socket_control/socket_control.h"
@@ -32,6 +39,16 @@
 #include "../log/log.h"
 #include "../sqlconnpool/sqlconnpool.h"
 #include "../sqlconnpool/sqlconnRAII.h"
+#include "../sqlconnpool/asyncsql.h"
+#include "../authcache/authcache.h"
+#include "../session/session.h"
+#include "../coro/cotask.h"
+#include "../coro/cotimer.h"
+#include "../fileindex/fileindex.h"
+#include "../blobstore/blobstore.h"
+#include "../egress/egress.h"
+#include "../affinity/affinity.h"
+#include "../router/router.hpp"
 
 
 class Http_Conn{
@@ -57,20 +74,81 @@ enum CHECK_STATE { CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_
     FILE_REQUEST        :   文件请求,获取文件成功
     INTERNAL_ERROR      :   表示服务器内部错误
     CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+    ASYNC_REQUEST       :   表示请求交给了异步数据库，等结果回来后再继续处理
+    PAGE_REQUEST        :   页面请求,响应体是在内存中生成的页面,比如文件列表
 */
-enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, ASYNC_REQUEST, PAGE_REQUEST };
+/*
+    发送一次响应的结果
+    WRITE_DONE      :   响应发完了，保持连接，已经重新注册读事件
+    WRITE_CLOSE     :   响应发完了，不保持连接，需要关闭
+    WRITE_PARTIAL   :   用完了这次允许发送的字节数，还没发完
+    WRITE_BLOCKED   :   写缓冲满了，已经注册可写事件
+    WRITE_ERROR     :   出错，需要关闭
+*/
+enum WRITE_RESULT { WRITE_DONE = 0, WRITE_CLOSE, WRITE_PARTIAL, WRITE_BLOCKED, WRITE_ERROR };
 // 从状态机的三种可能状态，即行的读取状态，分别表示
 // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
 enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
+/*
+    请求交给哪一个线程池处理，不同的请求互相隔离，一类请求把自己的线程池占满了不会拖慢别的请求
+    LANE_STATIC     :   静态页面和文件下载，只做内存映射，很快
+    LANE_DB         :   登陆和注册，要访问数据库，线程数按数据库连接池的大小
+    LANE_IO         :   上传、删除和文件列表，要读写磁盘或者生成页面
+*/
+enum LANE { LANE_STATIC = 0, LANE_DB, LANE_IO, LANE_COUNT };
+/*
+    反应堆(Reactor)模式下主线程只分发就绪事件，放入线程池时告诉工作线程这次要做什么
+    TASK_PROCESS    :   解析请求、生成响应，模拟Proactor模式下都是这个
+    TASK_READ       :   先读套接字，再解析请求、生成响应
+    TASK_WRITE      :   发送响应
+*/
+enum IO_TASK { TASK_PROCESS = 0, TASK_READ, TASK_WRITE };
+
+/*
+    主线程每个事件、工作线程每个请求都会访问的热数据
+    不放在连接对象里，而是按套接字下标放在一个连续的数组中，每个元素按64字节对齐，正好占一条缓存行
+    这样处理一个事件只需要碰一条缓存行，相邻的连接被不同线程写时也不会互相把对方的缓存行挤掉
+    解析和生成响应用到的字符串、哈希表、文件状态等冷数据还在连接对象里
+*/
+struct alignas(64) Hot{
+    Http_Conn* conn;//这个套接字当前对应的连接对象，没有连接时为空
+    //writev去发送数据，在需要发送文件的时候，写缓冲中放的响应行和响应头，放在第一个元素中，文件就放在第二个元素中
+    //如果不需要发送文件，只有第一个元素放写缓冲中的响应行和响应头，第二个元素用不上
+    struct iovec iv[2];
+    CHECK_STATE check_state;//主状态机当前所处的状态
+    int bytes_to_send;// 需要发送的字节个数,上限代表是几个G，所以没必要再用long了
+    int bytes_have_send;    // 已经发送的字节
+    int iv_count;
+    bool linger; //判断是否保持连接
+    bool corked;//写不进去后打开了TCP_CORK，响应发完时再关掉
+    bool held;//上一次发送带了MSG_MORE，内核里可能还留着不满一个报文段的数据
+};
 
 public:
-    //由于都共享一个epollfd，所以先弄成静态的
-    static int m_epollfd;//所有socket上的事件都被注册到同一个epoll上
+    //由于都共享一个事件后端，所以先弄成静态的
+    static Poller* m_poller;//所有socket上的事件都被注册到同一个事件后端上(epoll或io_uring)
     static int m_user_count;//用户数量,用在了监听套接字有连接请求时，判断如果连接过多，就不要了
-    //文件名最大长度
-    static const int FILENAME_LEN = 1024;
+    //从数据库取出密码的缓冲区长度，表里的password是varchar(50)
+    static const int PASSWORD_LEN = 64;
+    //异步数据库的结果回来后，主线程用它把任务重新放回线程池
+    static std::function<bool(Http_Conn*)> m_resume;
+    //工作线程生成响应后是否直接发送，热重启收尾时主线程会关掉它，空闲连接只由主线程判断
+    static std::atomic<bool> m_direct_write;
+    //是否用反应堆模式，读写都在工作线程，热重启收尾时主线程会换回模拟Proactor模式
+    static std::atomic<bool> m_reactor;
+    //是否合并发送：写不进去后用TCP_CORK只发满的报文段，流水线的下一个响应马上跟着时用MSG_MORE和它合在一起发
+    static bool m_coalesce;
+    //每个连接读写缓冲区的初始大小，由配置决定，要在第一个连接对象创建前设置
+    static int m_buffer_size;
+    //热数据表，下标就是套接字，大小是进程能打开的描述符数量
+    static Hot* m_hot_table;
+    static int m_hot_size;
+    //主线程启动时调用，用匿名映射申请热数据表，没用到的页不占物理内存
+    static bool InitHotTable(int size);
+    static void FreeHotTable();
 public:
-    Http_Conn(){//所有的都默认初始化
+    Http_Conn():m_hot(nullptr),m_sockfd(-1),m_file_address(nullptr),m_incoming_cpu(-1),m_lane(LANE_STATIC),m_io_task(TASK_PROCESS),m_read_buffer(m_buffer_size),m_write_buffer(m_buffer_size),m_generation(0),m_async_done(false),m_idle(false),m_tasks(0),m_closing_fd(-1){//所有的都默认初始化
 
     };
     ~Http_Conn(){
@@ -79,15 +157,44 @@ public:
 
 public://这些是主线程或者子线程调用的函数，接口函数
     void Process();//这个是任务类中的处理事件，由子线程调用。
+    //主线程放进线程池之前调用，排队和执行中的任务都算，Process结束时减一
+    void Hold() { m_tasks.fetch_add(1, std::memory_order_relaxed); }
+    void Release() { m_tasks.fetch_sub(1, std::memory_order_release); }
+    //主线程回收已关闭的连接时调用，还有任务在排队或执行时返回false，下一轮再试
+    //没有任务了才真正关闭套接字，在这之前描述符不会被新连接复用，热数据表中的位置也就不会被两个连接同时写
+    bool Reclaim();
     void Init(int sockfd,const sockaddr_in&addr);//虽然创建好了对象，但是里面的sock之类的只有真的有值了才能赋值，所以有个初始化函数
     void Close_Conn();//关闭连接，因为用户数量也要变，所以干脆写在http_conn中,注意在主线程中关闭，所以不需要保护，如果是子线程自己关，需要进行保护
+    int Slot() const { return m_hot ? static_cast<int>(m_hot - m_hot_table) : -1; }//连接在热数据表中的下标
+    int IncomingCpu() const { return m_incoming_cpu; }//收这个连接的包的CPU，不按它选工作线程时是-1
+    //主线程调用，取出所有已经关闭的连接追加到closed后面，由主线程从连接表中摘掉并放回slab
+    static void TakeClosed(std::vector<Http_Conn*>& closed);
+    //线程池只能由主线程放任务，工作线程发完响应后发现还有流水线的请求时，放进这个列表并用eventfd唤醒主线程
+    //工作线程关闭连接时也用这个eventfd唤醒主线程来回收
+    static bool InitPipelined(Poller* poller);
+    static bool OwnsPipelined(int fd) { return fd == m_pipelined_fd; }
+    //主线程调用，取出还没关闭的连接，由主线程分类后放回线程池
+    static void TakePipelined(std::vector<Http_Conn*>& conns);
+    static void FreePipelined();
     bool Read(); //非阻塞的读
     bool Write(); //非阻塞的写
+    //最多发送limit个字节，sent带出实际发送的字节数，大响应由发送调度按份额调用
+    WRITE_RESULT Write_Some(int limit, int &sent);
+    //主线程调用，上一个响应已经发完、下一个请求还没开始读，热重启时这样的长连接可以直接交给新进程
+    bool IsIdle() const { return m_idle && m_read_buffer.ReadableBytes() == 0; }
+    //主线程读完数据后调用，只看请求行和有没有会话cookie决定交给哪个线程池，不改动读缓冲区
+    LANE Classify();
+    //上一次分类的结果，异步数据库和协程把连接放回线程池时用
+    LANE Lane() const { return m_lane; }
+    //反应堆模式下主线程放入线程池前设置，工作线程取出后清掉
+    void SetTask(IO_TASK task) { m_io_task = task; }
 
 private://以下是由外部接口函数调用的函数
 
     //一些成员变量的初始化，由init调用
     void Clean();
+    //Process去掉任务计数后的部分
+    void Process_();
 
     //解析HTTP请求
     HTTP_CODE Process_Read();
@@ -98,11 +205,51 @@ private://以下是由外部接口函数调用的函数
     HTTP_CODE Process_Connect(char* text);//解析请求体
     LINE_STATUS Parse_Line(char* &lineEnd);//解析是否存在一个完整行
     HTTP_CODE Do_Request();//根据获取指令进行对应的操作
+    //路由的处理函数，rest指向url中路由匹配的部分后面，前缀路由是剩下的文件名，完整路径的路由是?后面的参数或者空串
+    typedef HTTP_CODE (Http_Conn::*Handler)(const char* rest);
+    typedef Router<Handler> HttpRouter;
+    //路由表在这里定义，处理函数都是私有的
+    static const HttpRouter& Routes();
+    HTTP_CODE Do_Download(const char* rest);//下载文件，没有登陆时返回登陆页面
+    HTTP_CODE Do_Delete(const char* rest);//删除文件，返回剩下的文件列表，没有登陆时返回登陆页面
+    HTTP_CODE Do_Hidden(const char* rest);//不允许直接请求的页面
+    HTTP_CODE Do_File_List(const char* rest);//文件列表，没有登陆时返回登陆页面
+    HTTP_CODE Do_Upload(const char* rest);//上传文件，返回加上新文件的文件列表，没有登陆时丢掉文件返回登陆页面
+    HTTP_CODE Do_Login(const char* rest);//登陆，没有注册的POST都按登陆处理
+    HTTP_CODE Do_Register(const char* rest);//注册
+    HTTP_CODE Do_Verify(bool isLogin);//登陆和注册都要先解析用户名密码再查数据库
     void ParseFromUrlencoded_();//解析登陆和注册输入的消息体的内容
     bool UserVerify(const std::string &name, const std::string &pwd, bool isLogin); //对登陆和注册在一个函数中操作MYSQL，返回成功与否
+    //先查凭证缓存，缓存能确定结果就返回true，并通过result带出登陆或注册是否成功
+    bool CheckAuthCache(const std::string &name, const std::string &pwd, bool isLogin, bool &result);
+    //把登陆注册交给异步数据库，返回false说明不需要等待（缓存命中或参数不对），result就是结果
+    bool UserVerifyAsync(const std::string &name, const std::string &pwd, bool isLogin, bool &result);
+    //异步数据库的回调，在主线程执行，generation用来判断连接是不是已经换成了别的客户
+    void Resume_Verify(unsigned int generation, bool ok);
+    HTTP_CODE Verify_Result(bool ok, bool isLogin);//根据登陆注册的结果决定返回的页面
+    //工作线程直接发送响应，返回false说明不能直接发，要注册可写事件由主线程发送
+    bool Direct_Write();
+    //在工作线程发送响应，发完或者写不进去时注册下一个事件，出错或者不保持连接时关闭
+    void Worker_Write();
+    //读缓冲区里已经有要处理的请求，交给主线程按请求的种类放回线程池，可以在工作线程调用
+    void Hand_To_Main();
+    //读缓冲区里是不是已经有流水线发来的下一个完整的GET请求，它的响应马上就会跟着发出去
+    bool Has_Pipelined() const;
+    //没有下一个响应可以合并了，把TCP_CORK或MSG_MORE留在内核里的数据发出去
+    void Flush_Held();
+#ifdef USE_COROUTINE
+    //协程模式下每个连接的处理流程，读请求、查数据库、发响应都写成顺序的co_await
+    CoTask Serve();
+    //协程用到的等待体，定义在http_coro.cpp中
+    struct IoAwaiter;//等待套接字可读，或者等待响应发完
+    struct VerifyAwaiter;//等待异步数据库的登陆注册结果
+    struct SleepAwaiter;//等待一段时间
+#endif
     void Process_File();//解析文件并保存文件
-    void GetFileHtmlPage();
-    void GetFileVec(const std::string dirName, std::vector<std::string> &resVec);//获取所有上传到服务器进行保存的文件名
+    //用目录索引生成文件列表的一页，query是url中?后面的分页、排序和搜索参数
+    HTTP_CODE FileListPage(const std::string &query);
+    bool IsLoggedIn();//请求是否带着有效的会话cookie
+    HTTP_CODE Login_Page();//文件相关的接口没有登陆时都返回登陆页面
     HTTP_CODE Map(char* file); //把指定的文件进行内存映射
     void unMap();//取消内存映射
 
@@ -114,10 +261,8 @@ private://以下是由外部接口函数调用的函数
     //生成响应需要调用的函数
     bool Add_Response(const char* format,...);//往写缓冲中写入数据
     bool Add_Status_Line(int status,const char* title);//写入响应行
-    bool Add_Headers(int content_len);//写入响应头
-    bool Add_Content_Length(int content_len);//响应头中需要写入的响应体长度
-    bool Add_Linger();//响应头中写入是否保持连接
-    bool Add_Blank_Line();//写入空行
+    //写入响应头，响应体长度、是否保持连接和空行用预先拼好的片段一次拷贝进写缓冲
+    bool Add_Headers(int content_len);
     bool Add_Content(const char* content);//除了文件以外的如果需要写入其他响应体，用这个函数
 
 
@@ -126,51 +271,60 @@ private://以下是由外部接口函数调用的函数
 
 
 private:
-    int m_sockfd;//这个任务对应的套接字
-    sockaddr_in m_address;//通信的socket地址
-
+    //读写时会访问的数据放在前面，其余的热数据在热数据表中
+    Hot* m_hot;//这个连接在热数据表中的位置，Init时绑定，关闭后主线程靠它回收对象
+    int m_sockfd;//这个任务对应的套接字，只在Init和关闭时修改，保证只关闭一次
+    char* m_file_address;//客户请求的目标文件被mmap到内存中的位置
+    int m_incoming_cpu;//Init时取一次，主线程放入线程池时用来选同一节点上的工作线程
+    LANE m_lane;//当前请求所在的线程池，只在主线程修改
+    IO_TASK m_io_task;//这次放入线程池要做的事
 
     //新的读缓冲区和写缓冲区
     Buffer m_read_buffer;
     Buffer m_write_buffer;
 
-    
+    //以下是只在解析请求和生成响应时用到的冷数据
+    sockaddr_in m_address;//通信的socket地址
     std::string m_url; //请求目标文件的文件名
-    char m_real_file[FILENAME_LEN];//真正的要发送的文件路径
-    std::string m_version; //协议版本，支持HTTP1.1和1.0
+    std::string m_real_file;//真正的要发送的文件路径，用到时才分配，不再每个连接固定占1KB
+    bool m_http10; //协议版本是不是HTTP1.0，只支持HTTP1.1和1.0，解析请求行时确定，生成状态行时直接选
     METHOD m_mehtod; //请求方法
 
     long m_content_length; //记录消息体长度，http的头部信息中应该要有
-    bool m_linger; //判断是否保持连接
     std::string m_content_type;//内容类型
     std::string m_boundary;//post文件时的边界
-
-    //主状态机当前所处的状态
-    CHECK_STATE m_check_state;
-
+    std::string m_session;//请求头Cookie中带的会话id
+    std::string m_set_cookie;//登陆成功后新建的会话id，需要在响应头中通过Set-Cookie发给客户端
 
     struct stat m_file_stat;//客户要获取的文件的状态，用stat查看，并保存在这里
-    char* m_file_address;//客户请求的目标文件被mmap到内存中的位置
-    
-    //writev去发送数据，在需要发送文件的时候，写缓冲中放的响应行和响应头，放在第一个元素中，文件就放在第二个元素中
-    //如果不需要发送文件，只有第一个元素放写缓冲中的响应行和响应头，第二个元素用不上
-    struct iovec m_iv[2];
-    int m_iv_count;
-
+    std::string m_content;//在内存中生成的响应体，发送时和文件一样放在iv的第二个元素
 
     //因为close时，除了主线程的close，其他情况下线程也会close，为了防止静态变量被多次不正确改变，所以需要用互斥锁
     Locker mutex;
     //因为用了mysql，防止幻读，加个读写锁
     RWlocker rwlock;
-    
-    int m_bytes_to_send;// 需要发送的字节个数,上限代表是几个G，所以没必要再用long了
-    int m_bytes_have_send;    // 已经发送的字节
 
     bool m_isdownload;//因为发送文件回去时浏览器默认是打开而不是下载，需要添加一个消息头来说明是下载，isdownload为true就添加下载消息头
 
     std::unordered_map<std::string, std::string> post_;//因为登陆和注册都需要输入用户和密码，就先保存在哈希表中
-    
 
+    unsigned int m_generation;//每次Init加一，用来识别异步回调回来时连接是否已经被复用
+    bool m_async_done;//异步数据库的结果是否已经回来，回来了Process就直接从结果接着处理
+    bool m_async_ok;//异步数据库的结果
+    std::atomic<bool> m_idle;//Init和响应发完时置位，读到数据时清掉，工作线程直接发送时也会置位
+    std::atomic<int> m_tasks;//在线程池里排队和正在执行的任务数
+    int m_closing_fd;//Close_Conn后还没真正关闭的套接字，由主线程在Reclaim时关闭
+#ifdef USE_COROUTINE
+    CoTask m_task;//这个连接的协程，Init时新建
+    bool m_verify_login;//Do_Request留给协程的是登陆还是注册
+#endif
+
+    //已经关闭、等待主线程回收的连接，工作线程也会关闭连接，所以要加锁
+    static Locker m_closed_mutex;
+    static std::vector<Http_Conn*> m_closed;
+    //等主线程放回线程池的连接和放入时的generation，也用m_closed_mutex保护
+    static std::vector<std::pair<Http_Conn*, unsigned int>> m_pipelined;
+    static int m_pipelined_fd;
 
 };
 
@@ -0,0 +1,129 @@
+/*
+协程模式下的请求处理流程(make CORO=1)
+和原来一样由主线程读写套接字、工作线程解析和生成响应，只是工作线程上的流程写成了一个协程：
+解析不完整时co_await等待可读，登陆注册时co_await等待数据库，生成响应后co_await等待发送完成，
+挂起时不占用工作线程，主线程把连接重新放回线程池后，Process会从挂起的地方接着执行
+
+*/
+#include "http_conn.h"
+
+#ifdef USE_COROUTINE
+
+#define CORO_SQL_RETRY 3 //异步数据库排队的任务太多时最多重试几次，之后改为同步查询
+#define CORO_SQL_BACKOFF_MS 5 //每次重试前等待的时间，单位ms
+
+//挂起时注册读或写事件，主线程读到下一个请求、或者写完响应并读到下一个请求后，重新放回线程池恢复
+struct Http_Conn::IoAwaiter{
+    Http_Conn* conn;
+    uint32_t events;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<>) {
+        //连接已经关了就不再注册，协程一直挂着，连接复用时会被销毁
+        if(conn->m_sockfd != -1) {
+            Modfd(m_poller, conn->m_sockfd, events);
+        }
+    }
+    void await_resume() {}
+};
+
+//缓存命中、数据库不是异步的都不用挂起，直接得到结果
+//需要挂起时在await_suspend中提交，回调在主线程通过Resume_Verify把连接放回线程池
+struct Http_Conn::VerifyAwaiter{
+    Http_Conn* conn;
+    bool isLogin;
+    bool sync;//重试次数用完了，直接同步查询
+    bool busy;//异步数据库的队列满了，没有提交成功
+    bool suspended;
+    bool result;
+
+    VerifyAwaiter(Http_Conn* c, bool login, bool syncOnly)
+        : conn(c), isLogin(login), sync(syncOnly), busy(false), suspended(false), result(false) {}
+
+    bool await_ready() {
+        const std::string& name = conn->post_["username"];
+        const std::string& pwd = conn->post_["password"];
+        if(name == "" || pwd == "") {
+            return true;
+        }
+        if(conn->CheckAuthCache(name, pwd, isLogin, result)) {
+            return true;
+        }
+        if(sync || !AsyncSql::Instance()->IsOpen()) {
+            result = conn->UserVerify(name, pwd, isLogin);
+            return true;
+        }
+        return false;
+    }
+    bool await_suspend(std::coroutine_handle<>) {
+        suspended = true;
+        Http_Conn* c = conn;
+        unsigned int generation = conn->m_generation;
+        AsyncSql::JOB_TYPE type = isLogin ? AsyncSql::JOB_LOGIN : AsyncSql::JOB_REGISTER;
+        //提交成功后协程可能马上在别的线程被恢复，之后就不能再访问这个等待体了
+        if(AsyncSql::Instance()->Submit(type, conn->post_["username"], conn->post_["password"],
+                                        [c, generation](bool ok) { c->Resume_Verify(generation, ok); })) {
+            return true;
+        }
+        suspended = false;
+        busy = true;
+        return false;//不挂起，由协程决定是等一会再试还是同步查询
+    }
+    bool await_resume() {
+        return suspended ? conn->m_async_ok : result;
+    }
+};
+
+//到时间后在主线程把连接放回线程池
+struct Http_Conn::SleepAwaiter{
+    Http_Conn* conn;
+    int ms;
+
+    bool await_ready() { return ms <= 0; }
+    void await_suspend(std::coroutine_handle<>) {
+        Http_Conn* c = conn;
+        unsigned int generation = conn->m_generation;
+        CoTimer::Instance()->Add(ms, [c, generation]() {
+            if(generation != c->m_generation || c->m_sockfd == -1) {
+                return;//等待期间连接已经关了
+            }
+            if(!m_resume || !m_resume(c)) {
+                c->Close_Conn();
+            }
+        });
+    }
+    void await_resume() {}
+};
+
+CoTask Http_Conn::Serve(){
+    while(true){
+        HTTP_CODE ret = Process_Read();
+        if(ret == NO_REQUEST){//请求不完整，等主线程读到更多数据
+            Flush_Held();
+            co_await IoAwaiter{this, EPOLLIN};
+            continue;
+        }
+        if(ret == ASYNC_REQUEST){//登陆或注册
+            Flush_Held();
+            bool ok = false;
+            for(int retry = 0; ; ++retry){
+                VerifyAwaiter verify(this, m_verify_login, retry >= CORO_SQL_RETRY);
+                ok = co_await verify;
+                if(!verify.busy){
+                    break;
+                }
+                co_await SleepAwaiter{this, CORO_SQL_BACKOFF_MS};
+            }
+            ret = Verify_Result(ok, m_verify_login);
+        }
+        if(!Process_Write(ret)){
+            LOG_ERROR("process_write() error");
+            Close_Conn();
+            co_return;
+        }
+        //主线程写完响应后会重新注册读事件，下一个请求读到后从这里继续，读缓冲区里已经有下一个请求时马上继续
+        co_await IoAwaiter{this, EPOLLOUT};
+    }
+}
+
+#endif
@@ -4,6 +4,7 @@
 */
 
 #include "log.h"
+#include "../affinity/affinity.h"
 
 using namespace std;
 
@@ -211,5 +212,6 @@ Log* Log::Instance() {//获取日志单例
 }
 
 void Log::FlushLogThread() {//线程的执行函数
+    CpuAffinity::Instance()->PinLog();
     Log::Instance()->AsyncWrite_();
 }
\ No newline at end of file
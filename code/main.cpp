@@ -30,11 +30,14 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/tcp.h>
 
 #include <signal.h>
 #include <iostream>
 
 #include <memory>
+#include <vector>
 #include "locker/locker.h"
 #include "socket_control/socket_control.h"
 #include "threadpool/threadpool.hpp"
@@ -42,11 +45,97 @@
 #include "timer/heaptimer.h"
 #include "log/log.h"
 #include "sqlconnpool/sqlconnpool.h"
-
-
-#define MAX_FD 65535 //最大的套接字数量
-#define MAX_EVENT_NUMBER 50000 //允许同时发生的最大数量
-#define OVERTIME_MS 60000 //每个连接的时间，单位ms，如果这么长时间没有读时间发生，就会断开连接，如果有时间发生，在时间结束后会再延长这么久
+#include "sqlconnpool/asyncsql.h"
+#include "authcache/authcache.h"
+#include "session/session.h"
+#include "slab/slab.hpp"
+#include "poller/poller.h"
+#include "fileindex/fileindex.h"
+#include "blobstore/blobstore.h"
+#include "ratelimit/ratelimiter.h"
+#include "egress/egress.h"
+#include "handoff/handoff.h"
+#include "config/config.h"
+#include "affinity/affinity.h"
+
+
+//下面的可调参数都可以在配置文件中修改，这里是配置文件没有写时的默认值，配置项的名字和说明见webserver.conf
+//带(auto)的参数在mode = auto或者写成auto时按CPU核数、内存和描述符上限计算，带(live)的参数收到SIGHUP后重新读取生效
+#define CONFIG_PATH "./webserver.conf" //配置文件的路径
+#define FD_RESERVED 64 //留给监听套接字、日志、数据库连接等的描述符数量，其余的都可以给客户连接
+#define CONN_SLAB_CHUNK 256 //连接对象每次按块分配的个数
+#define CONN_MEM_ESTIMATE 32768 //auto模式估算连接数上限时每个连接占用的内存，包括内核的套接字缓冲，单位字节
+#define MAX_EVENT_NUMBER 50000 //允许同时发生的最大数量(auto)
+#define OVERTIME_MS 60000 //每个连接的时间，单位ms，如果这么长时间没有读时间发生，就会断开连接，如果有时间发生，在时间结束后会再延长这么久(live)
+#define THREAD_NUM 6 //线程池最少的线程数，一直保留(auto)
+#define THREAD_MAX 24 //线程池最多的线程数，数据库等阻塞的操作让任务积压时才会增加到这么多(auto)
+#define POOL_GROW_WAIT_MS 10 //有积压并且任务平均排队时间超过这个数时加一个线程，单位ms
+#define POOL_IDLE_MS 10000 //连续这么久没有积压并且有线程闲着时退掉一个线程，单位ms
+#define POOL_ADJUST_MS 100 //检查线程池是否需要伸缩的周期，单位ms
+#define POOL_TIMER_ID -4 //线程池伸缩的周期任务在时间堆中的id
+#define DB_LANE_QUEUE 1024 //登陆注册的线程池每个请求队列的最大任务数，线程数跟数据库连接池的最少和最多连接数一样
+#define IO_LANE_THREADS 2 //上传、删除和文件列表的线程池最少的线程数
+#define IO_LANE_MAX 8 //上传、删除和文件列表的线程池最多的线程数(auto)
+#define IO_LANE_QUEUE 256 //上传、删除和文件列表的线程池每个请求队列的最大任务数
+#define MAX_REQUESTS 10000 //线程池每个请求队列的最大任务数(auto)
+#define CONN_BUFFER 1024 //每个连接读写缓冲区的初始大小，不够时会自动增长，单位字节(auto)
+#define LISTEN_BACKLOG 4096 //监听队列的长度，超过内核的somaxconn时会被截断(auto)
+#define DEFER_ACCEPT_S 0 //TCP_DEFER_ACCEPT，客户端发来数据后才accept，最多等这么多秒，0表示不用
+#define TCP_FASTOPEN_QLEN 0 //TCP Fast Open的队列长度，老客户端可以在SYN里带上请求，省一个往返，0表示不用
+#define NODELAY true //关掉Nagle算法，设置在监听套接字上，accept出来的连接会继承，小响应不用等上一个报文的确认
+#define COALESCE true //合并发送，写不进去后打开TCP_CORK只发满的报文段，流水线的请求用MSG_MORE把几个响应合在一起发
+#define LOG_LEVEL 1 //日志等级，0是debug，1是info，2是warn，3是error(live)
+#define LOG_QUEUE 1024 //异步日志队列的长度，0表示同步写日志(auto)
+#define CPU_AFFINITY false //是否把主线程、工作线程和日志线程绑定到CPU上
+#define REACTOR_CPU "" //主线程绑定的CPU，空表示用允许使用的第一个CPU
+#define WORKER_CPUS "" //工作线程绑定的CPU列表，如"1-7,9"，空表示用主线程所在NUMA节点的其余CPU，不够时再用别的节点
+#define LOG_CPUS "" //日志线程可以使用的CPU列表，空表示主线程所在节点的所有CPU
+#define SQL_HOST "localhost" //数据库的地址
+#define SQL_PORT 3306 //数据库的端口
+#define SQL_USER "debian-sys-maint" //数据库的用户名
+#define SQL_PASSWORD "mysql" //数据库的密码
+#define SQL_DB "webserver" //使用的数据库
+#define SQL_CONN_MIN 4 //数据库连接池的最少连接数(auto)
+#define SQL_CONN_MAX 16 //数据库连接池的最多连接数，等待连接时会在这个范围内增长(auto)
+#define SQL_ACQUIRE_TIMEOUT_MS 3000 //获取数据库连接的超时时间，单位ms
+#define AUTH_CACHE_TTL_MS 300000 //登陆凭证在缓存中保存的时间，单位ms
+#define AUTH_NEGATIVE_TTL_MS 10000 //不存在的用户在缓存中保存的时间，单位ms
+#define AUTH_CACHE_ENTRIES 100000 //凭证缓存的最大条目数
+#define SESSION_TTL_MS 1800000 //会话没有访问时的存活时间，单位ms
+#define SESSION_MAX 100000 //最多保存的会话数量
+#define SESSION_SWEEP_MS 10000 //清理过期会话的周期，单位ms
+#define SESSION_TIMER_ID -1 //清理会话的周期任务在时间堆中的id，负数不会和套接字冲突
+#ifndef EVENT_BACKEND
+#define EVENT_BACKEND Poller::BACKEND_EPOLL //事件后端，BACKEND_URING只是用io_uring等待就绪，读写还是普通的系统调用，不可用时自动退回epoll
+#endif
+#define ASYNC_SQL_CONN 4 //异步数据库的连接数量，0代表不使用异步数据库，登陆注册在工作线程中同步查询(auto)
+#define ASYNC_SQL_TIMEOUT_MS 3000 //异步数据库每一步的期限，超过就断开连接，这次登陆注册失败
+#ifndef FILE_DEDUP
+#define FILE_DEDUP false //上传的文件是否按内容去重保存，相同内容的文件只在./filedir/.blobs中保存一份
+#endif
+#define RATE_IP_PER_SEC 200 //每个IP每秒允许的新连接数，0表示不限制(live)
+#define RATE_IP_BURST 400 //每个IP的令牌桶容量，允许的瞬时突发连接数(live)
+#define RATE_GLOBAL_PER_SEC 20000 //所有IP加起来每秒允许的新连接数，0表示不限制(live)
+#define RATE_GLOBAL_BURST 40000 //全局令牌桶的容量(live)
+#define RATE_TABLE_SIZE 65536 //保存IP令牌桶的哈希表大小(live)
+#define RATE_EXEMPT "" //不做IP限速的网段，逗号分隔的CIDR列表，仍受全局限速，空表示没有(live)
+#define ADMIT_MAX_PENDING 5000 //线程池中积压的任务超过这个数就拒绝新连接(live)
+#define ADMIT_MAX_WAIT_MS 200 //任务平均排队时间超过这个数就拒绝新连接，单位ms(live)
+#define BUSY_RETRY_AFTER 1 //过载时让客户端多少秒后重试(live)
+#define EGRESS_RATE 0 //所有连接加起来的发送速率上限，字节/秒，三个速率都是0时不做发送调度(live)
+#define EGRESS_IP_RATE 0 //每个IP的发送速率上限，字节/秒，0表示不限制(live)
+#define EGRESS_CONN_RATE 0 //每个连接的发送速率上限，字节/秒，0表示不限制(live)
+#define EGRESS_SMALL_RESPONSE 65536 //不超过这个字节数的响应算交互请求，立即发送(live)
+#define EGRESS_QUANTUM 65536 //差额轮询时每轮每个连接的份额，字节(live)
+#define EGRESS_BURST_MS 100 //配额最多攒多少毫秒的量(live)
+#define EGRESS_TICK_MS 10 //补充配额的周期，单位ms
+#define EGRESS_TIMER_ID -2 //补充配额的周期任务在时间堆中的id
+#define HANDOFF_PATH "./webserver.sock" //热重启时新进程从这个Unix套接字拿走监听套接字
+#define HANDOFF_DRAIN_MS 30000 //交出监听套接字后等待已有请求处理完的期限，超过就直接退出，单位ms
+#define HANDOFF_SCAN_MS 100 //收尾时检查空闲长连接并交给新进程的周期，单位ms
+#define HANDOFF_TIMER_ID -3 //交接空闲连接的周期任务在时间堆中的id
+#define EVENT_MODE "proactor" //事件处理模式，proactor是主线程读写、工作线程处理，reactor是主线程只分发事件、工作线程自己读写
+#define DIRECT_WRITE true //工作线程生成响应后直接发送，写不进去时才注册可写事件交给主线程，发送调度开着时不直接发送
 
 
 //添加信号的函数
@@ -61,17 +150,138 @@ void Addsig(int sig,void(*handler)(int)){
 
 
 
+//把进程能打开的描述符数量的软限制提高到硬限制，返回最终的限制
+static int RaiseFdLimit(){
+    struct rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE,&rl) == -1){
+        return 1024;
+    }
+    if(rl.rlim_cur < rl.rlim_max){
+        rlim_t old = rl.rlim_cur;
+        rl.rlim_cur = rl.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE,&rl) == -1){
+            rl.rlim_cur = old;
+        }
+    }
+    //无限制时也给一个上限，连接表是按描述符下标的，不能无限大
+    if(rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > (1 << 20)){
+        return 1 << 20;
+    }
+    return static_cast<int>(rl.rlim_cur);
+}
+
+//过载或者超过限速时直接回复503，Retry-After告诉客户端多久后再试，调用者随后关闭连接
+//回复前后把已经到达的请求读掉，不然带着没读的数据关闭会发RST，客户端可能收不到这个回复
+void SendBusy(int fd,int retryAfter){
+    static const char body[] = "503,The server is busy, please retry later.\n";
+    char buf[256];
+    int len = snprintf(buf,sizeof(buf),"HTTP/1.1 503 Service Unavailable\r\nRetry-After: %d\r\nContent-Length: %d\r\nConnection: close\r\n\r\n%s",
+                       retryAfter,(int)strlen(body),body);
+    char drain[4096];
+    while(recv(fd,drain,sizeof(drain),MSG_DONTWAIT) > 0){}
+    send(fd,buf,len,MSG_DONTWAIT | MSG_NOSIGNAL);
+    shutdown(fd,SHUT_WR);
+    while(recv(fd,drain,sizeof(drain),MSG_DONTWAIT) > 0){}
+}
+
+//收到SIGHUP时置位，主线程在下一轮循环重新读取配置文件
+static volatile sig_atomic_t reloadConfig = 0;
+void ReloadHandler(int sig){
+    reloadConfig = 1;
+}
+
+//运行中可以修改的参数，启动时和收到SIGHUP时从配置文件读取
+//线程数、连接数、数据库等启动时就定下来的参数只能重启生效，可以用热重启的方式换上
+struct LiveConfig{
+    int overtimeMs;
+    int admitMaxPending;
+    int admitMaxWaitMs;
+    int busyRetryAfter;
+};
+
+static void ApplyLiveConfig(LiveConfig& live){
+    Config* conf = Config::Instance();
+    live.overtimeMs = conf->GetInt("overtime_ms",OVERTIME_MS);
+    live.admitMaxPending = conf->GetInt("admit_max_pending",ADMIT_MAX_PENDING);
+    live.admitMaxWaitMs = conf->GetInt("admit_max_wait_ms",ADMIT_MAX_WAIT_MS);
+    live.busyRetryAfter = conf->GetInt("busy_retry_after",BUSY_RETRY_AFTER);
+    Log::Instance()->SetLevel(conf->GetInt("log_level",LOG_LEVEL));
+    //限速和发送调度只在主线程使用，直接重新初始化，已有的令牌桶和配额会被重置
+    RateLimiter::Instance()->Init(conf->GetDouble("rate_ip_per_sec",RATE_IP_PER_SEC),conf->GetDouble("rate_ip_burst",RATE_IP_BURST),
+                                  conf->GetDouble("rate_global_per_sec",RATE_GLOBAL_PER_SEC),conf->GetDouble("rate_global_burst",RATE_GLOBAL_BURST),
+                                  conf->GetInt("rate_table_size",RATE_TABLE_SIZE),conf->GetString("rate_exempt",RATE_EXEMPT));
+    EgressScheduler::Instance()->Init(conf->GetLong("egress_rate",EGRESS_RATE),conf->GetLong("egress_ip_rate",EGRESS_IP_RATE),
+                                      conf->GetLong("egress_conn_rate",EGRESS_CONN_RATE),conf->GetInt("egress_small_response",EGRESS_SMALL_RESPONSE),
+                                      conf->GetInt("egress_quantum",EGRESS_QUANTUM),conf->GetInt("egress_burst_ms",EGRESS_BURST_MS));
+}
+
+//listen的队列长度不超过内核的上限，auto模式直接用内核的上限
+static int Somaxconn(){
+    int n = SOMAXCONN;
+    FILE* fp = fopen("/proc/sys/net/core/somaxconn","r");
+    if(fp){
+        if(fscanf(fp,"%d",&n) != 1){
+            n = SOMAXCONN;
+        }
+        fclose(fp);
+    }
+    return n;
+}
+
+static int Clamp(long long n,int low,int high){
+    return static_cast<int>(n < low ? low : (n > high ? high : n));
+}
+
 //用于传给定时器的超时回调函数
-void TimeCallBack(Http_Conn * user,int fd){
-    user[fd].Close_Conn();
+void TimeCallBack(Http_Conn::Hot * user,int fd){
+    //连接可能已经被工作线程关闭并回收了，表里就是空的
+    if(user[fd].conn){
+        user[fd].conn->Close_Conn();
+    }
+}
+
+//时间堆的周期任务，清理过期的会话
+void SessionCallBack(Http_Conn::Hot * user,int id){
+    SessionManager::Instance()->Sweep();
+}
+
+//时间堆的周期任务，补充发送配额并继续发送大文件
+void EgressCallBack(Http_Conn::Hot * user,int id){
+    EgressScheduler::Instance()->Tick();
+}
+
+//时间堆的周期任务，按排队时间伸缩线程池
+static ThreadPool<Http_Conn>* lanes[Http_Conn::LANE_COUNT];
+
+//把连接放进线程池，先记一个任务，连接关闭后主线程要等这些任务都做完才回收
+static bool Dispatch(ThreadPool<Http_Conn>* pool,Http_Conn* conn,int prefer = -1){
+    conn->Hold();
+    if(!pool->Append(conn,prefer)){
+        //没放进去，不会有Process来减掉
+        conn->Release();
+        return false;
+    }
+    return true;
+}
+void PoolCallBack(Http_Conn::Hot * user,int id){
+    for(int i = 0; i < Http_Conn::LANE_COUNT; ++i){
+        lanes[i]->Adjust(POOL_ADJUST_MS);
+    }
+}
+
+//时间堆的周期任务，热重启收尾时把空闲的长连接交给新进程
+void HandoffCallBack(Http_Conn::Hot * user,int id){
+    Handoff::Instance()->Drain();
 }
 
 
 int main(int argc,char* argv[]) {
 
-    if(argc!=2)
+    //加上-r是热重启，从正在运行的旧进程手里接过监听套接字，拿不到时照常绑定端口
+    bool restart = argc==3 && strcmp(argv[2],"-r")==0;
+    if(argc!=2 && !restart)
     {
-        printf("运行方式 : %s <port>\n" , argv[0]);
+        printf("运行方式 : %s <port> [-r]\n" , argv[0]);
         exit(1);//直接退出程序
     }
 
@@ -79,70 +289,282 @@ int main(int argc,char* argv[]) {
     //就这里添加了个信号，没有添加其他信号
     Addsig(SIGPIPE,SIG_IGN);
 
+    //收到SIGHUP时重新读取配置文件
+    Addsig(SIGHUP,ReloadHandler);
+
+    //配置文件要最先读，日志、线程池、数据库的大小都来自配置
+    //日志还没有初始化，读取的结果等日志初始化后再记录
+    Config* conf = Config::Instance();
+    bool confLoaded = conf->Load(CONFIG_PATH);
+    //auto模式按机器的资源计算各个参数
+    int cores = Config::Cores();
+    long long memory = Config::MemoryBytes();
+
+    //连接对象不再一开始就为每个可能的套接字都分配，而是accept时从slab中取，关闭后放回slab复用
+    //users是以套接字为下标的热数据表，每个元素一条缓存行，放着连接对象的指针和每个事件都要用的状态
+    //连接数上限由进程能打开的描述符数量决定，auto模式下还要看内存够不够
+    int fdLimit = RaiseFdLimit();
+    int maxConn = conf->GetInt("max_conn",fdLimit - FD_RESERVED,
+                               Clamp(std::min<long long>(fdLimit - FD_RESERVED,memory / 4 / CONN_MEM_ESTIMATE),1,fdLimit));
+    if(maxConn < 1){
+        maxConn = 1;
+    }
+    if(maxConn > fdLimit - FD_RESERVED){
+        maxConn = std::max(1,fdLimit - FD_RESERVED);
+    }
+    int threadNum = conf->GetInt("thread_num",THREAD_NUM,std::max(2,cores));
+    int threadMax = conf->GetInt("thread_max",THREAD_MAX,Clamp(4LL * cores,threadNum,64));
+    int maxRequests = conf->GetInt("max_requests",MAX_REQUESTS,Clamp(maxConn / threadNum,1024,MAX_REQUESTS * 10));
+    int maxEvents = conf->GetInt("max_event_number",MAX_EVENT_NUMBER,Clamp(maxConn,1024,65536));
+    //每个连接平均能分到的内存的1/16给读写两个缓冲区，大内存的机器少一些扩容
+    int connBuffer = conf->GetInt("conn_buffer",CONN_BUFFER,Clamp(memory / 32 / maxConn,1024,8192));
+    int backlog = conf->GetInt("listen_backlog",LISTEN_BACKLOG,Somaxconn());
+    int logQueue = conf->GetInt("log_queue",LOG_QUEUE,Clamp(1024LL * cores,1024,65536));
+    int sqlConnMin = conf->GetInt("sql_conn_min",SQL_CONN_MIN,std::min(4,cores));
+    int sqlConnMax = conf->GetInt("sql_conn_max",SQL_CONN_MAX,Clamp(2LL * cores,4,64));
+    int ioLaneThreads = conf->GetInt("io_lane_threads",IO_LANE_THREADS);
+    int ioLaneMax = conf->GetInt("io_lane_max",IO_LANE_MAX,Clamp(cores,ioLaneThreads,16));
+    int asyncSqlConn = conf->GetInt("async_sql_conn",ASYNC_SQL_CONN,Clamp(cores / 2,1,16));
+    std::string sqlHost = conf->GetString("sql_host",SQL_HOST);
+    int sqlPort = conf->GetInt("sql_port",SQL_PORT);
+    std::string sqlUser = conf->GetString("sql_user",SQL_USER);
+    std::string sqlPassword = conf->GetString("sql_password",SQL_PASSWORD);
+    std::string sqlDb = conf->GetString("sql_db",SQL_DB);
+    std::string backend = conf->GetString("event_backend","");
+    Poller::BACKEND eventBackend = backend == "epoll" ? Poller::BACKEND_EPOLL : (backend == "uring" ? Poller::BACKEND_URING : EVENT_BACKEND);
+
+    //CPU绑定要在创建日志线程和线程池之前确定，主线程先绑上，新线程启动时再各自绑定
+    CpuAffinity* affinity = CpuAffinity::Instance();
+    affinity->Init(conf->GetBool("cpu_affinity",CPU_AFFINITY),conf->GetString("reactor_cpu",REACTOR_CPU),
+                   conf->GetString("worker_cpus",WORKER_CPUS),conf->GetString("log_cpus",LOG_CPUS),threadNum);
+    affinity->PinReactor();
+
     //日志是单例模式的，不需要new，只需要对日志进行初始化
-    Log::Instance()->Init(1,"./log",".log",1024);
+    Log::Instance()->Init(conf->GetInt("log_level",LOG_LEVEL),"./log",".log",logQueue);
+    LOG_INFO("Config %s %s, mode %s, %d cores, %lld MB memory", CONFIG_PATH, confLoaded ? "loaded" : "not found",
+             conf->IsAuto() ? "auto" : "manual", cores, memory >> 20);
+    LOG_INFO("threads %d-%d, io threads %d-%d, queue %d, events %d, buffer %d, backlog %d, log queue %d, sql %d-%d, async sql %d",
+             threadNum, threadMax, ioLaneThreads, ioLaneMax, maxRequests, maxEvents, connBuffer, backlog, logQueue, sqlConnMin, sqlConnMax, asyncSqlConn);
+    LOG_INFO("CPU affinity: %s", affinity->Describe().c_str());
 
     //sql连接池也是单例模式，只需要对其进行一个初始化即可
-    SqlConnPool::Instance()->Init("localhost",3306,"debian-sys-maint","mysql","webserver",8);
+    SqlConnPool::Instance()->Init(sqlHost.c_str(),sqlPort,sqlUser.c_str(),sqlPassword.c_str(),sqlDb.c_str(),sqlConnMin,sqlConnMax,conf->GetInt("sql_acquire_timeout_ms",SQL_ACQUIRE_TIMEOUT_MS));
+    //登陆凭证缓存也是单例模式，放在数据库前面
+    AuthCache::Instance()->Init(conf->GetInt("auth_cache_ttl_ms",AUTH_CACHE_TTL_MS),conf->GetInt("auth_negative_ttl_ms",AUTH_NEGATIVE_TTL_MS),
+                                conf->GetInt("auth_cache_entries",AUTH_CACHE_ENTRIES));
+    //会话管理也是单例模式
+    SessionManager::Instance()->Init(conf->GetInt("session_ttl_ms",SESSION_TTL_MS),conf->GetInt("session_max",SESSION_MAX));
+    //新连接的限速和下载的发送调度，只在主线程使用，运行中可以重新读取
+    LiveConfig live;
+    ApplyLiveConfig(live);
+    //上传文件的保存方式，要在目录索引之前，会清理上次遗留的临时文件
+    BlobStore::Instance()->Init("./filedir",conf->GetBool("file_dedup",FILE_DEDUP),!restart);
+    //文件目录的索引，启动时遍历一次，之后随上传和删除更新
+    FileIndex::Instance()->Init("./filedir");
 
     //创建一个时间堆
     HeapTimer timeheap;
+    //会话的过期清理由时间堆驱动
+    timeheap.AddPeriodic(SESSION_TIMER_ID,conf->GetInt("session_sweep_ms",SESSION_SWEEP_MS),SessionCallBack);
+    //下载的发送调度，配置了速率时才需要周期地补充配额，重新读取配置后才打开的也在那时加上
+    int egressTick = conf->GetInt("egress_tick_ms",EGRESS_TICK_MS);
+    bool egressTimer = EgressScheduler::Instance()->IsOpen();
+    if(egressTimer){
+        timeheap.AddPeriodic(EGRESS_TIMER_ID,egressTick,EgressCallBack);
+    }
+    //调度发出了数据也算连接上有事件，限速后的大文件可能要发很久，不能被当成不活跃的连接关掉
+    EgressScheduler::Instance()->SetProgressCallback([&timeheap](Http_Conn* conn){ timeheap.Happen(conn->Slot()); });
     
-    //创建一个用http状态机这个类处理http协议的线程池，初始化线程池
-    std::shared_ptr<ThreadPool<Http_Conn>> pool(new ThreadPool<Http_Conn>);//结束后会自动delete
-
-    //由于http_conn中需要保存套接字，所以干脆套接字信息都保存在http_conn中，所以先为每一个可能存在的套接字都分配一个任务
-    Http_Conn *users = new Http_Conn[MAX_FD];
-
-    //创建监听套接字
-    int listenfd = socket(PF_INET,SOCK_STREAM,0);
-    if(listenfd == -1)//套接字创建失败
-    {
-        LOG_ERROR("socket() error");
-        exit(1);
+    //创建用http状态机这个类处理http协议的线程池，按请求的种类分成三个，各自有线程数和队列长度的限制
+    //登陆注册或者上传把自己的线程池占满时，静态页面还在自己的线程池里处理，不会排在它们后面
+    //同步访问数据库时每个线程占一个数据库连接，登陆注册的线程数和数据库连接池一样，多了也只是等连接
+    std::shared_ptr<ThreadPool<Http_Conn>> pool(new ThreadPool<Http_Conn>(threadNum,maxRequests,threadMax));//结束后会自动delete
+    //只有静态页面的线程按下标绑CPU，另外两个线程池的下标也从0开始，绑的话会和它挤在同样的几个CPU上
+    std::shared_ptr<ThreadPool<Http_Conn>> dbPool(new ThreadPool<Http_Conn>(sqlConnMin,conf->GetInt("db_lane_queue",DB_LANE_QUEUE),sqlConnMax,false));
+    std::shared_ptr<ThreadPool<Http_Conn>> ioPool(new ThreadPool<Http_Conn>(ioLaneThreads,conf->GetInt("io_lane_queue",IO_LANE_QUEUE),ioLaneMax,false));
+    lanes[Http_Conn::LANE_STATIC] = pool.get();
+    lanes[Http_Conn::LANE_DB] = dbPool.get();
+    lanes[Http_Conn::LANE_IO] = ioPool.get();
+    pool->SetName("StaticPool");
+    dbPool->SetName("DbPool");
+    ioPool->SetName("IoPool");
+    //线程数由时间堆的周期任务按排队时间伸缩
+    for(int i = 0; i < Http_Conn::LANE_COUNT; ++i){
+        lanes[i]->SetPolicy(conf->GetInt("pool_grow_wait_ms",POOL_GROW_WAIT_MS) * 1000,conf->GetInt("pool_idle_ms",POOL_IDLE_MS));
     }
-    //设置一个端口复用
-    int reuse =1;
-    setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-    //绑定
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr,0,sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(atoi(argv[1]));
-    if(bind(listenfd,(struct sockaddr*)&serv_addr, sizeof(serv_addr)) == -1){
-        //perror("bind() error");
-        LOG_ERROR("bind() error");
+    timeheap.AddPeriodic(POOL_TIMER_ID,POOL_ADJUST_MS,PoolCallBack);
+
+    Http_Conn::m_buffer_size = connBuffer;
+    Http_Conn::m_direct_write = conf->GetBool("direct_write",DIRECT_WRITE);
+    Http_Conn::m_coalesce = conf->GetBool("tcp_coalesce",COALESCE);
+    //反应堆模式下请求在工作线程读到，主线程没法按请求分类，都交给静态页面的线程池
+    Http_Conn::m_reactor = conf->GetString("event_mode",EVENT_MODE) == "reactor";
+    if(!Http_Conn::InitHotTable(fdLimit)){
         exit(1);
     }
-    //监听
-    if(listen(listenfd,100) == -1){
-        LOG_ERROR("listen() error");
-        //perror("listen() error");
-        exit(1);
+    Http_Conn::Hot* users = Http_Conn::m_hot_table;
+    Slab<Http_Conn> slab(CONN_SLAB_CHUNK);
+    std::vector<Http_Conn*> closed;//从已关闭列表中取出的连接，每轮循环回收一次
+
+    std::string handoffPath = conf->GetString("handoff_path",HANDOFF_PATH);
+    //热重启时直接用旧进程的监听套接字，端口一直在监听，重启期间到来的连接不会被拒绝
+    int listenfd = restart ? Handoff::Instance()->TakeOver(handoffPath) : -1;
+    if(restart && listenfd == -1){
+        LOG_WARN("Hot restart failed, bind port %s", argv[1]);
+    }
+    if(listenfd == -1){
+        //创建监听套接字
+        listenfd = socket(PF_INET,SOCK_STREAM,0);
+        if(listenfd == -1)//套接字创建失败
+        {
+            LOG_ERROR("socket() error");
+            exit(1);
+        }
+        //设置一个端口复用
+        int reuse =1;
+        setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+        //绑定
+        struct sockaddr_in serv_addr;
+        memset(&serv_addr,0,sizeof(serv_addr));
+        serv_addr.sin_family = AF_INET;
+        serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        serv_addr.sin_port = htons(atoi(argv[1]));
+        if(bind(listenfd,(struct sockaddr*)&serv_addr, sizeof(serv_addr)) == -1){
+            //perror("bind() error");
+            LOG_ERROR("bind() error");
+            exit(1);
+        }
+        //监听
+        //这两个选项都是可选的，内核不支持时只是没有效果
+        int deferAccept = conf->GetInt("defer_accept_s",DEFER_ACCEPT_S);
+        if(deferAccept > 0 && setsockopt(listenfd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&deferAccept,sizeof(deferAccept)) == -1){
+            LOG_WARN("TCP_DEFER_ACCEPT not supported");
+        }
+        int fastOpen = conf->GetInt("tcp_fastopen",TCP_FASTOPEN_QLEN);
+        if(fastOpen > 0 && setsockopt(listenfd,IPPROTO_TCP,TCP_FASTOPEN,&fastOpen,sizeof(fastOpen)) == -1){
+            LOG_WARN("TCP_FASTOPEN not supported");
+        }
+        if(listen(listenfd,backlog) == -1){
+            LOG_ERROR("listen() error");
+            //perror("listen() error");
+            exit(1);
+        }
+    }
+    //热重启接过来的监听套接字也按新的配置设置
+    int nodelay = conf->GetBool("tcp_nodelay",NODELAY) ? 1 : 0;
+    if(setsockopt(listenfd,IPPROTO_TCP,TCP_NODELAY,&nodelay,sizeof(nodelay)) == -1){
+        LOG_WARN("TCP_NODELAY not supported");
     }
 
 
-    //创建epoll对象
-    int epfd = epoll_create(100);
-    // 将监听的文件描述符相关的检测信息添加到epoll实例中，用一个函数实现
-    Addfd(epfd,listenfd,false,false);
+    //创建事件后端，注册的描述符不会超过进程的描述符上限
+    Poller* poller = Poller::Create(eventBackend,fdLimit);
+    if(poller == nullptr){
+        exit(1);
+    }
+    // 将监听的文件描述符相关的检测信息添加到事件后端中，用一个函数实现
+    Addfd(poller,listenfd,false,false);
     //允许同时发生事件是有上限的
-    struct epoll_event epevs[MAX_EVENT_NUMBER];
+    std::vector<struct epoll_event> epevs(maxEvents);
+
+    Http_Conn::m_poller = poller;
 
-    Http_Conn::m_epollfd = epfd;
+    //异步数据库的套接字也放在这个事件后端中，由主线程推进查询，结果回来后把任务重新放回线程池
+    //异步数据库的回调和协程的定时器都在主线程执行，用它把连接重新放回线程池
+    Http_Conn::m_resume = [](Http_Conn* conn){ return Dispatch(lanes[conn->Lane()],conn); };
+    if(asyncSqlConn > 0){
+        AsyncSql::Instance()->Init(sqlHost.c_str(),sqlPort,sqlUser.c_str(),sqlPassword.c_str(),sqlDb.c_str(),asyncSqlConn,poller,conf->GetInt("async_sql_timeout_ms",ASYNC_SQL_TIMEOUT_MS));
+    }
+    if(!Http_Conn::InitPipelined(poller)){
+        exit(1);
+    }
+    std::vector<Http_Conn*> pipelined;//工作线程交回来的、读缓冲区里还有流水线请求的连接
+#ifdef USE_COROUTINE
+    if(!CoTimer::Instance()->Init(poller)){
+        exit(1);
+    }
+#endif
+    //等待下一次热重启，失败了只是不能热重启，不影响服务
+    Handoff::Instance()->Init(handoffPath,listenfd,conf->GetInt("handoff_drain_ms",HANDOFF_DRAIN_MS),poller);
+    std::vector<int> adopted;//旧进程交过来的空闲长连接
 
     LOG_INFO("========== Server init ==========");
+    LOG_INFO("Max clients: %d, event backend: %s, event mode: %s", maxConn, poller->Name(), Http_Conn::m_reactor ? "reactor" : "proactor");
 
     while(1) {
 
+        //流水线的请求已经在读缓冲区里了，像读完数据一样分类后放回线程池
+        //要在回收已关闭的连接之前做，这时列表里已经关闭的连接还没被复用
+        Http_Conn::TakePipelined(pipelined);
+        for(Http_Conn* conn : pipelined){
+            if(!Dispatch(lanes[conn->Classify()],conn)){
+                SendBusy(conn->Slot(),live.busyRetryAfter);
+                conn->Close_Conn();
+                continue;
+            }
+            timeheap.Happen(conn->Slot());
+        }
+        pipelined.clear();
+
+        //回收已经关闭的连接，表中对应位置如果还是它就置空，然后放回slab
+        //还有任务在排队或执行的连接留在closed里，下一轮再试
+        Http_Conn::TakeClosed(closed);
+        size_t busyClosed = 0;
+        for(Http_Conn* conn : closed){
+            if(!conn->Reclaim()){
+                closed[busyClosed++] = conn;
+                continue;
+            }
+            EgressScheduler::Instance()->Remove(conn);
+            int slot = conn->Slot();
+            if(slot >= 0 && users[slot].conn == conn){
+                users[slot].conn = nullptr;
+            }
+            slab.Free(conn);
+        }
+        closed.resize(busyClosed);
+
+        //收到SIGHUP，重新读取配置文件中运行时可以修改的参数
+        if(reloadConfig){
+            reloadConfig = 0;
+            if(conf->Reload()){
+                ApplyLiveConfig(live);
+                if(!egressTimer && EgressScheduler::Instance()->IsOpen()){
+                    timeheap.AddPeriodic(EGRESS_TIMER_ID,egressTick,EgressCallBack);
+                    egressTimer = true;
+                }
+                LOG_INFO("Config reloaded");
+            }
+        }
+
+        //监听套接字交出去后，手上的连接都处理完或者到了期限就退出
+        if(Handoff::Instance()->Done()){
+            break;
+        }
+
         //获取要等待的时间,单位是ms,如果时间堆为空，timeout=-1.
         //获取时间之前会先处理超时的定时器
-        int timeout = timeheap.GetNextTick(users,OVERTIME_MS);
+        int timeout = timeheap.GetNextTick(users,live.overtimeMs);
+#ifdef USE_COROUTINE
+        //协程的定时器也在这里处理，等待时间取两者中较早的
+        int coTimeout = CoTimer::Instance()->Tick();
+        if(coTimeout >= 0 && (timeout < 0 || coTimeout < timeout)){
+            timeout = coTimeout;
+        }
+#endif
+        //异步数据库每一步的期限也在这里检查
+        int sqlTimeout = AsyncSql::Instance()->Tick();
+        if(sqlTimeout >= 0 && (timeout < 0 || sqlTimeout < timeout)){
+            timeout = sqlTimeout;
+        }
+        //还有等工作线程做完才能回收的连接时不能一直睡，很快再来看一次
+        if(!closed.empty() && (timeout < 0 || timeout > 1)){
+            timeout = 1;
+        }
 
-        int number = epoll_wait(epfd, epevs, MAX_EVENT_NUMBER, timeout);
-        if(number == -1) {//由于信号处理中设置了restart，所以-1绝对是出问题了，而不是信号打断
-            LOG_ERROR("epoll_wait() error");
+        int number = poller->Wait(epevs.data(), maxEvents, timeout);
+        if(number == -1) {//信号打断时Wait返回0，所以-1绝对是出问题了
+            LOG_ERROR("poller wait error");
             exit(-1);
         }
 
@@ -155,56 +577,164 @@ int main(int argc,char* argv[]) {
                 struct sockaddr_in cliaddr;
                 socklen_t len = sizeof(cliaddr);
                 while(1){//这里添加一个循环，免得每次只取一个，就很麻烦
-                    int connfd = accept(listenfd, (struct sockaddr *)&cliaddr, &len);
+                    //accept4直接得到非阻塞的套接字，不用再调用两次fcntl
+                    int connfd = accept4(listenfd, (struct sockaddr *)&cliaddr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
                     if(connfd<0){
                         if(errno == EAGAIN || errno== EWOULDBLOCK){
                             break;
                         }
+                        //客户端在accept前就断开了，接着取下一个
+                        if(errno == ECONNABORTED || errno == EINTR){
+                            continue;
+                        }
+                        //描述符用完了，先处理别的事件，监听套接字是水平触发的，下一轮还会通知
+                        if(errno == EMFILE || errno == ENFILE){
+                            LOG_WARN("accept() error, too many open files");
+                            break;
+                        }
                         LOG_ERROR("accept() error");
                         exit(-1);
                     }
-                    if(Http_Conn::m_user_count>=MAX_FD){
+                    //连接满了、超过限速或者线程池已经积压时，尽早回复503拒绝，不让过载继续堆积
+                    //ET模式下拒绝后要继续取，不能break，不然积压的连接要等下一个连接到来才会被处理
+                    if(Http_Conn::m_user_count>=maxConn){
                         LOG_WARN("Clients is full!");
+                        SendBusy(connfd,live.busyRetryAfter);
                         close(connfd);
-                        break;
+                        continue;
+                    }
+                    int retryAfter;
+                    if(!RateLimiter::Instance()->Allow(cliaddr,retryAfter)){
+                        SendBusy(connfd,retryAfter);
+                        close(connfd);
+                        continue;
+                    }
+                    //队列空着时平均排队时间不会再更新，只在有积压时参考
+                    //只看静态页面的线程池，登陆和上传的线程池满了由它们自己的队列长度限制，不影响新连接
+                    int pending = pool->Pending();
+                    if(pending >= live.admitMaxPending || (pending > 0 && pool->WaitUs() >= live.admitMaxWaitMs * 1000)){
+                        LOG_WARN("Server is busy, pending %d, wait %dus", pending, pool->WaitUs());
+                        SendBusy(connfd,live.busyRetryAfter);
+                        close(connfd);
+                        continue;
                     }
                     //直接把描述符值当索引，放到对应位置的任务中。//本来是需要在外面添加上epfd的，但是由于任务内部也有epfd，所以在任务内部添加了epfd
-                    users[connfd].Init(connfd,cliaddr);
+                    //同一个描述符上旧的连接已经关闭，它会在已关闭列表中被回收，这里直接换成新对象
+                    if(connfd >= fdLimit){//描述符的限制被外部调小了才会出现
+                        close(connfd);
+                        continue;
+                    }
+                    slab.Alloc()->Init(connfd,cliaddr);
                     //加入与套接字相对应的定时器
-                    timeheap.Add(connfd,OVERTIME_MS,TimeCallBack);
+                    timeheap.Add(connfd,live.overtimeMs,TimeCallBack);
                     
                 }
+            } else if(Http_Conn::OwnsPipelined(curfd)){
+                //只是唤醒，列表在下一轮开头处理
+                continue;
+            } else if(AsyncSql::Instance()->Owns(curfd)){
+                //异步数据库的套接字或者唤醒用的eventfd
+                AsyncSql::Instance()->HandleEvent(curfd,epevs[i].events);
+            } else if(Handoff::Instance()->Owns(curfd)){
+                //新进程连上了控制套接字，或者旧进程交过来了空闲的长连接
+                Handoff::Instance()->HandleEvent(curfd,adopted);
+                if(listenfd >= 0 && Handoff::Instance()->Draining()){
+                    //监听套接字已经交给新进程并关掉了，描述符可能被复用，不能再拿来比较
+                    listenfd = -1;
+                    timeheap.AddPeriodic(HANDOFF_TIMER_ID,conf->GetInt("handoff_scan_ms",HANDOFF_SCAN_MS),HandoffCallBack);
+                }
+                for(int fd : adopted){
+                    //连接还是原来的客户，地址从套接字上取
+                    struct sockaddr_in cliaddr;
+                    socklen_t len = sizeof(cliaddr);
+                    if(fd >= fdLimit || Http_Conn::m_user_count >= maxConn || getpeername(fd,(struct sockaddr*)&cliaddr,&len) < 0){
+                        close(fd);
+                        continue;
+                    }
+                    slab.Alloc()->Init(fd,cliaddr);
+                    timeheap.Add(fd,live.overtimeMs,TimeCallBack);
+                }
+                adopted.clear();
+            }
+#ifdef USE_COROUTINE
+            else if(CoTimer::Instance()->Owns(curfd)){
+                //协程添加了更早的定时器，下一轮重新计算等待时间
+                CoTimer::Instance()->HandleEvent();
+            }
+#endif
+            else if(users[curfd].conn == nullptr){
+                //连接已经被回收，残留的事件直接忽略
+                continue;
             } else if(epevs[i].events & (EPOLLRDHUP | EPOLLRDHUP |EPOLLERR)){//EPOLLERR没注册
                 //如果是对面传来的关闭信号，这里就直接关闭
                 //由于sock直接存在任务中，直接在任务中写好关闭连接，并进行关闭即可
-                users[curfd].Close_Conn();
+                users[curfd].conn->Close_Conn();
+            }
+            else if((epevs[i].events & EPOLLIN) && Http_Conn::m_reactor){
+                //反应堆模式下主线程不读，交给工作线程去读和处理，读到的不是静态请求时工作线程再交回来放到对应的线程池
+                users[curfd].conn->SetTask(Http_Conn::TASK_READ);
+                if(!Dispatch(pool.get(),users[curfd].conn,affinity->PickWorker(users[curfd].conn->IncomingCpu()))){
+                    SendBusy(curfd,live.busyRetryAfter);
+                    users[curfd].conn->Close_Conn();
+                    continue;
+                }
+                timeheap.Happen(curfd);
             }
             else if(epevs[i].events & EPOLLIN){
                 //如果是读的事件,直接在主进程读
-                if(users[curfd].Read()){
-                    //读完后再加入请求队列
-                    if(!pool->Append(&users[curfd])){
-                        //加入失败也关闭连接
-                        users[curfd].Close_Conn();
+                if(users[curfd].conn->Read()){
+                    //读完后按请求的种类加入对应线程池的请求队列
+                    //静态页面的工作线程跨了NUMA节点时，交给和收包的CPU同一节点的线程
+                    Http_Conn::LANE lane = users[curfd].conn->Classify();
+                    int prefer = lane == Http_Conn::LANE_STATIC ? affinity->PickWorker(users[curfd].conn->IncomingCpu()) : -1;
+                    if(!Dispatch(lanes[lane],users[curfd].conn,prefer)){
+                        //这个线程池的请求队列都满了，回复503后关闭连接
+                        SendBusy(curfd,live.busyRetryAfter);
+                        users[curfd].conn->Close_Conn();
                         continue;
                     }
                     //如果读成功并且成功加入请求队列，就要标注此事件，后面时间堆处理超时事件时如果有标注就不会清理，而是扩展时间
                     timeheap.Happen(curfd);
                 }else{//如果读失败，直接关闭连接
-                    users[curfd].Close_Conn();
+                    users[curfd].conn->Close_Conn();
+                }
+            }else if((epevs[i].events & EPOLLOUT) && Http_Conn::m_reactor && !EgressScheduler::Instance()->IsOpen()){
+                //反应堆模式下也由工作线程发送，发送调度开着时还是主线程按配额发
+                //线程池满了时响应已经发出去一部分，不能再回503，由主线程自己接着发
+                users[curfd].conn->SetTask(Http_Conn::TASK_WRITE);
+                if(!Dispatch(pool.get(),users[curfd].conn)){
+                    users[curfd].conn->SetTask(Http_Conn::TASK_PROCESS);
+                    if(!users[curfd].conn->Write()){
+                        users[curfd].conn->Close_Conn();
+                        continue;
+                    }
                 }
+                timeheap.Happen(curfd);
             }else if(epevs[i].events & EPOLLOUT){//write会一次性写完所有数据，如果写失败了，也要关闭连接
-                    if(!users[curfd].Write()){
-                        users[curfd].Close_Conn();
+                    if(!users[curfd].conn->Write()){
+                        users[curfd].conn->Close_Conn();
+                        continue;
                     }
+                    timeheap.Happen(curfd);
                 }
 
         }
     }
 
-    close(listenfd);
-    close(epfd);
-    delete[] users;
-    //pool用了智能指针，不用手动delelt
+    if(listenfd >= 0){
+        close(listenfd);
+    }
+    //热重启到了期限时工作线程可能还在处理被丢下的连接，先停掉三个线程池等它们退出，
+    //之后才能释放事件后端、热数据表和slab中的连接对象
+    for(int i = 0; i < Http_Conn::LANE_COUNT; ++i){
+        lanes[i] = nullptr;
+    }
+    pool.reset();
+    dbPool.reset();
+    ioPool.reset();
+    delete poller;
+    Http_Conn::FreeHotTable();
+    Http_Conn::FreePipelined();
+    //连接对象由slab持有，slab析构时一起释放
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,110 @@
+#include "poller.h"
+#include "uringpoller.h"
+#include <unistd.h>
+#include <errno.h>
+#include "../log/log.h"
+
+Poller* Poller::Create(BACKEND backend, int maxFd) {
+    if(backend == BACKEND_URING) {
+        UringPoller* uring = new UringPoller();
+        if(uring->Init(maxFd)) {
+            return uring;
+        }
+        delete uring;
+        LOG_WARN("io_uring unavailable, fall back to epoll");
+    }
+    EpollPoller* poller = new EpollPoller();
+    if(!poller->Init(maxFd)) {
+        delete poller;
+        return nullptr;
+    }
+    return poller;
+}
+
+EpollPoller::EpollPoller() : epollfd_(-1), maxFd_(0) {}
+
+EpollPoller::~EpollPoller() {
+    if(epollfd_ >= 0) {
+        close(epollfd_);
+    }
+}
+
+bool EpollPoller::Init(int maxFd) {
+    epollfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if(epollfd_ < 0) {
+        LOG_ERROR("epoll_create() error");
+        return false;
+    }
+    maxFd_ = maxFd;
+    armed_.reset(new std::atomic<uint32_t>[maxFd]);
+    for(int i = 0; i < maxFd; ++i) {
+        armed_[i].store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+bool EpollPoller::Add(int fd, uint32_t events) {
+    bool tracked = fd >= 0 && fd < maxFd_;
+    //先记下再注册，注册后事件可能马上在主线程返回并清零，顺序反了会留下已经触发过的掩码
+    if(tracked) {
+        armed_[fd].store(events, std::memory_order_relaxed);
+    }
+    struct epoll_event epev;
+    epev.events = events;
+    epev.data.fd = fd;
+    if(epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &epev) != 0) {
+        if(tracked) {
+            armed_[fd].store(0, std::memory_order_relaxed);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::Mod(int fd, uint32_t events) {
+    //还注册着同样的事件，一次性的也还没触发，再注册一次什么都不会改变
+    bool tracked = fd >= 0 && fd < maxFd_;
+    if(tracked && armed_[fd].load(std::memory_order_relaxed) == events) {
+        return true;
+    }
+    if(tracked) {
+        armed_[fd].store(events, std::memory_order_relaxed);
+    }
+    struct epoll_event epev;
+    epev.events = events;
+    epev.data.fd = fd;
+    if(epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd, &epev) != 0) {
+        if(tracked) {
+            armed_[fd].store(0, std::memory_order_relaxed);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool EpollPoller::Del(int fd) {
+    Forget(fd);
+    return epoll_ctl(epollfd_, EPOLL_CTL_DEL, fd, 0) == 0;
+}
+
+bool EpollPoller::Forget(int fd) {
+    if(fd >= 0 && fd < maxFd_) {
+        armed_[fd].store(0, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+int EpollPoller::Wait(struct epoll_event* events, int maxEvents, int timeoutMs) {
+    int number = epoll_wait(epollfd_, events, maxEvents, timeoutMs);
+    if(number < 0 && errno == EINTR) {
+        return 0;
+    }
+    //一次性的事件触发后内核已经不再监听，下一次Mod要真的注册
+    for(int i = 0; i < number; ++i) {
+        int fd = events[i].data.fd;
+        if(fd >= 0 && fd < maxFd_ && (armed_[fd].load(std::memory_order_relaxed) & EPOLLONESHOT)) {
+            armed_[fd].store(0, std::memory_order_relaxed);
+        }
+    }
+    return number;
+}
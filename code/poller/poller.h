@@ -0,0 +1,59 @@
+/*
+事件后端的抽象
+主循环、连接和异步数据库都只通过这个接口注册和等待事件，不再直接调用epoll
+事件的掩码和返回的结构都沿用epoll的，EPOLLONESHOT代表触发一次后要重新注册，
+没有EPOLLONESHOT的会一直监听
+后端记录每个描述符当前注册着的事件，重复注册同样的事件时不再调用系统调用
+现在有两个后端：epoll，以及用io_uring的POLL_ADD实现的后端，io_uring不可用时退回epoll
+
+*/
+#ifndef POLLER_H
+#define POLLER_H
+
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+
+class Poller{
+public:
+    enum BACKEND { BACKEND_EPOLL = 0, BACKEND_URING };
+
+    virtual ~Poller(){}
+
+    //以下三个函数主线程和工作线程都会调用
+    virtual bool Add(int fd, uint32_t events) = 0;
+    virtual bool Mod(int fd, uint32_t events) = 0;
+    virtual bool Del(int fd) = 0;
+    //描述符马上就要关闭时调用，epoll在描述符关闭时自己会删掉注册，不用再调用epoll_ctl
+    //描述符被复制过(比如热重启时发给了新进程)时关闭不会删掉注册，这时要用Del
+    virtual bool Forget(int fd) { return Del(fd); }
+    //只由主线程调用，timeoutMs为-1时一直等待，返回就绪的数量，出错返回-1
+    virtual int Wait(struct epoll_event* events, int maxEvents, int timeoutMs) = 0;
+    virtual const char* Name() const = 0;
+
+    //按指定的后端创建，maxFd是会注册的描述符的上限，创建失败时退回epoll，epoll也失败返回nullptr
+    static Poller* Create(BACKEND backend, int maxFd);
+};
+
+class EpollPoller : public Poller{
+public:
+    EpollPoller();
+    ~EpollPoller();
+    bool Init(int maxFd);
+    bool Add(int fd, uint32_t events);
+    bool Mod(int fd, uint32_t events);
+    bool Del(int fd);
+    bool Forget(int fd);
+    int Wait(struct epoll_event* events, int maxEvents, int timeoutMs);
+    const char* Name() const { return "epoll"; }
+
+private:
+    int epollfd_;
+    int maxFd_;
+    //每个描述符注册着的事件，0表示没有注册或者一次性的事件已经触发过
+    //一次性的事件触发后由Wait清零，之后的Mod一定会调用epoll_ctl
+    std::unique_ptr<std::atomic<uint32_t>[]> armed_;
+};
+
+#endif
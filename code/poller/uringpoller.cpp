@@ -0,0 +1,260 @@
+#include "uringpoller.h"
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include "../log/log.h"
+
+//内核和用户态共享的环的头尾指针，需要带内存屏障读写
+static inline unsigned LoadAcquire(const unsigned* p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+static inline void StoreRelease(unsigned* p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+//epoll的这些标志在poll里没有意义，注册时去掉
+static const uint32_t EPOLL_ONLY_FLAGS = EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE | EPOLLWAKEUP;
+
+UringPoller::UringPoller()
+    : ringfd_(-1), maxFd_(0), ringPtr_(MAP_FAILED), ringSize_(0), sqes_(nullptr), sqesSize_(0),
+      sqHead_(nullptr), sqTail_(nullptr), sqMask_(nullptr), sqEntries_(nullptr), sqArray_(nullptr),
+      cqHead_(nullptr), cqTail_(nullptr), cqMask_(nullptr), cqes_(nullptr), looping_(false) {}
+
+UringPoller::~UringPoller() {
+    if(sqes_) {
+        munmap(sqes_, sqesSize_);
+    }
+    if(ringPtr_ != MAP_FAILED) {
+        munmap(ringPtr_, ringSize_);
+    }
+    if(ringfd_ >= 0) {
+        close(ringfd_);
+    }
+}
+
+bool UringPoller::Init(int maxFd) {
+#if defined(IORING_FEAT_EXT_ARG) && defined(IORING_FEAT_NODROP) && defined(IORING_FEAT_SINGLE_MMAP)
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    //完成队列放大一些，大量连接同时就绪时也不容易溢出，溢出了内核也会先留着(NODROP)
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = RING_ENTRIES * 4;
+    ringfd_ = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+    if(ringfd_ < 0) {
+        LOG_WARN("io_uring_setup error %d", errno);
+        return false;
+    }
+    //等待时要带超时，需要EXT_ARG(5.11)
+    unsigned need = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP;
+    if((params.features & need) != need) {
+        LOG_WARN("io_uring features 0x%x not enough", params.features);
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ringSize_ = sqSize > cqSize ? sqSize : cqSize;
+    ringPtr_ = mmap(nullptr, ringSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+    if(ringPtr_ == MAP_FAILED) {
+        LOG_WARN("io_uring mmap ring error %d", errno);
+        return false;
+    }
+    sqesSize_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) {
+        LOG_WARN("io_uring mmap sqes error %d", errno);
+        return false;
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* ring = static_cast<char*>(ringPtr_);
+    sqHead_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+    sqMask_ = reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+    sqEntries_ = reinterpret_cast<unsigned*>(ring + params.sq_off.ring_entries);
+    sqArray_ = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+    cqHead_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+    cqMask_ = reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+
+    maxFd_ = maxFd;
+    states_.reset(new FdState[maxFd]);
+    for(int i = 0; i < maxFd; ++i) {
+        states_[i].reg.store(0, std::memory_order_relaxed);
+        states_[i].armed.store(false, std::memory_order_relaxed);
+    }
+    LOG_INFO("io_uring poller init, sq %u cq %u", params.sq_entries, params.cq_entries);
+    return true;
+#else
+    (void)maxFd;
+    return false;
+#endif
+}
+
+bool UringPoller::InLoop_() const {
+    return looping_.load(std::memory_order_acquire) && pthread_equal(loopThread_, pthread_self());
+}
+
+int UringPoller::Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs) {
+    if(!(flags & IORING_ENTER_GETEVENTS)) {
+        return syscall(__NR_io_uring_enter, ringfd_, toSubmit, 0, flags, nullptr, 0);
+    }
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if(timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+    return syscall(__NR_io_uring_enter, ringfd_, toSubmit, minComplete,
+                   flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+bool UringPoller::Push_(uint8_t op, int fd, uint32_t mask, uint64_t addr, uint64_t data, bool submit) {
+    std::lock_guard<std::mutex> locker(sqMtx_);
+    unsigned tail = *sqTail_;
+    //提交队列满了，先把里面的提交掉，没有SQPOLL时提交后内核已经取走了请求
+    while(tail - LoadAcquire(sqHead_) >= *sqEntries_) {
+        if(Enter_(tail - LoadAcquire(sqHead_), 0, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERROR("io_uring_enter submit error %d", errno);
+            return false;
+        }
+    }
+    unsigned index = tail & *sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = addr;
+    sqe->poll32_events = mask;
+    sqe->user_data = data;
+    sqArray_[index] = index;
+    StoreRelease(sqTail_, tail + 1);
+    if(submit) {
+        //主线程可能正阻塞在等待里，工作线程的修改要马上交给内核
+        if(Enter_(tail + 1 - LoadAcquire(sqHead_), 0, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERROR("io_uring_enter submit error %d", errno);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool UringPoller::Arm_(int fd, uint32_t events) {
+    if(fd < 0 || fd >= maxFd_) {
+        LOG_ERROR("io_uring fd %d out of range", fd);
+        return false;
+    }
+    FdState& state = states_[fd];
+    uint32_t mask = events & (~EPOLL_ONLY_FLAGS | EPOLLONESHOT);
+    //还注册着同样的事件，不用删掉再加一次
+    if(state.armed.load() && static_cast<uint32_t>(state.reg.load()) == mask) {
+        return true;
+    }
+    //代数和掩码一起换掉，主线程看到新代数时一定看到新的掩码
+    uint32_t old = Bump_(state, mask);
+    bool submit = !InLoop_();
+    if(state.armed.exchange(true)) {
+        //还注册着，先删掉旧的
+        Push_(IORING_OP_POLL_REMOVE, -1, 0, MakeData_(fd, old), IGNORE_DATA, false);
+    }
+    return Push_(IORING_OP_POLL_ADD, fd, mask & ~EPOLLONESHOT, 0, MakeData_(fd, old + 1), submit);
+}
+
+uint32_t UringPoller::Bump_(FdState& state, uint32_t mask) {
+    uint64_t cur = state.reg.load();
+    uint64_t next;
+    do {
+        next = ((cur >> 32) + 1) << 32 | mask;
+    } while(!state.reg.compare_exchange_weak(cur, next));
+    return static_cast<uint32_t>(cur >> 32);
+}
+
+bool UringPoller::Add(int fd, uint32_t events) {
+    return Arm_(fd, events);
+}
+
+bool UringPoller::Mod(int fd, uint32_t events) {
+    return Arm_(fd, events);
+}
+
+bool UringPoller::Del(int fd) {
+    if(fd < 0 || fd >= maxFd_) {
+        return false;
+    }
+    FdState& state = states_[fd];
+    uint32_t old = Bump_(state, EPOLLONESHOT);
+    if(state.armed.exchange(false)) {
+        return Push_(IORING_OP_POLL_REMOVE, -1, 0, MakeData_(fd, old), IGNORE_DATA, !InLoop_());
+    }
+    return true;
+}
+
+int UringPoller::Wait(struct epoll_event* events, int maxEvents, int timeoutMs) {
+    if(!looping_.load(std::memory_order_relaxed)) {
+        loopThread_ = pthread_self();
+        looping_.store(true, std::memory_order_release);
+    }
+    unsigned toSubmit;
+    {
+        std::lock_guard<std::mutex> locker(sqMtx_);
+        toSubmit = *sqTail_ - LoadAcquire(sqHead_);
+    }
+    //主线程攒下的请求和等待合成一次系统调用，完成队列里已经有事件就不等待
+    bool ready = LoadAcquire(cqTail_) != *cqHead_;
+    if(ready || timeoutMs == 0) {
+        if(toSubmit > 0 && Enter_(toSubmit, 0, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+    } else if(Enter_(toSubmit, 1, IORING_ENTER_GETEVENTS, timeoutMs) < 0) {
+        if(errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+            LOG_ERROR("io_uring_enter wait error %d", errno);
+            return -1;
+        }
+    }
+
+    int number = 0;
+    unsigned head = *cqHead_;
+    unsigned tail = LoadAcquire(cqTail_);
+    while(head != tail && number < maxEvents) {
+        struct io_uring_cqe* cqe = &cqes_[head & *cqMask_];
+        ++head;
+        uint64_t data = cqe->user_data;
+        if(data == IGNORE_DATA) {
+            continue;
+        }
+        int fd = static_cast<int>(data & 0xffffffffu);
+        uint32_t gen = static_cast<uint32_t>(data >> 32);
+        if(fd < 0 || fd >= maxFd_) {
+            continue;
+        }
+        FdState& state = states_[fd];
+        uint64_t reg = state.reg.load();
+        if(static_cast<uint32_t>(reg >> 32) != gen) {//已经修改或删除过，是旧的事件
+            continue;
+        }
+        if(cqe->res == -ECANCELED) {
+            continue;
+        }
+        uint32_t mask = static_cast<uint32_t>(reg);
+        if(!(mask & EPOLLONESHOT) && cqe->res >= 0) {
+            Push_(IORING_OP_POLL_ADD, fd, mask, 0, data, false);
+            //重新提交前工作线程可能已经改了注册，它删旧请求时这个还没提交，这里补一个删除
+            if(static_cast<uint32_t>(state.reg.load() >> 32) != gen) {
+                Push_(IORING_OP_POLL_REMOVE, -1, 0, data, IGNORE_DATA, false);
+            }
+        } else {
+            state.armed.store(false);
+        }
+        events[number].events = cqe->res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe->res);
+        events[number].data.fd = fd;
+        ++number;
+    }
+    StoreRelease(cqHead_, head);
+    return number;
+}
@@ -0,0 +1,86 @@
+/*
+用io_uring实现的事件后端
+没有依赖liburing，直接用系统调用和内核的共享环
+注册事件用IORING_OP_POLL_ADD，它本身就是触发一次就结束，正好对应EPOLLONESHOT，
+不是一次性的描述符在每次返回事件后由主线程重新提交
+主线程自己的注册、修改、删除都先放在提交队列里，等下一次Wait时和等待一起用一次io_uring_enter提交，
+工作线程的修改会立即提交，保证主线程在等待时也能收到
+每个描述符有一个代数，放在user_data的高32位，修改和删除时加一，旧代数的完成事件直接丢掉，
+这样描述符被关闭后复用，也不会把旧连接的事件交给新连接
+这里只用io_uring等待就绪，accept和读写还是由调用者用普通的系统调用完成，所以默认后端仍是epoll
+没有做多次触发的accept、内核提供缓冲区的recv、链接起来的发送和读文件、send_zc、异步的open/statx，
+每个请求的系统调用数和epoll后端一样，只省掉了主线程注册和等待之间的那次系统调用
+
+*/
+#ifndef URING_POLLER_H
+#define URING_POLLER_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <pthread.h>
+#include "poller.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+class UringPoller : public Poller{
+public:
+    UringPoller();
+    ~UringPoller();
+    //内核不支持io_uring或者缺少需要的特性时返回false
+    bool Init(int maxFd);
+    bool Add(int fd, uint32_t events);
+    bool Mod(int fd, uint32_t events);
+    bool Del(int fd);
+    int Wait(struct epoll_event* events, int maxEvents, int timeoutMs);
+    const char* Name() const { return "io_uring"; }
+
+private:
+    static const unsigned RING_ENTRIES = 4096;
+    static const uint64_t IGNORE_DATA = ~0ULL;//删除操作自己的完成事件
+
+    //每个描述符的注册状态
+    struct FdState{
+        //高32位是当前代数，低32位是注册的事件，带着EPOLLONESHOT的是一次性的，否则返回事件后要重新提交
+        //工作线程修改注册时主线程可能正在读，放在一个原子变量里，主线程读到的代数和掩码一定是同一次注册的
+        std::atomic<uint64_t> reg;
+        std::atomic<bool> armed;//内核里是否还有这个描述符的POLL_ADD
+    };
+
+    static uint64_t MakeData_(int fd, uint32_t gen) {
+        return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd);
+    }
+    bool Arm_(int fd, uint32_t events);
+    //代数加一，掩码换成mask，返回旧的代数
+    static uint32_t Bump_(FdState& state, uint32_t mask);
+    //往提交队列放一个请求，submit为true时立即提交
+    bool Push_(uint8_t op, int fd, uint32_t mask, uint64_t addr, uint64_t data, bool submit);
+    int Enter_(unsigned toSubmit, unsigned minComplete, unsigned flags, int timeoutMs);
+    bool InLoop_() const;
+
+    int ringfd_;
+    int maxFd_;
+    std::unique_ptr<FdState[]> states_;
+
+    void* ringPtr_;
+    size_t ringSize_;
+    io_uring_sqe* sqes_;
+    size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned* sqMask_;
+    unsigned* sqEntries_;
+    unsigned* sqArray_;
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned* cqMask_;
+    io_uring_cqe* cqes_;
+
+    std::mutex sqMtx_;//多个线程往提交队列放请求
+    std::atomic<bool> looping_;
+    pthread_t loopThread_;//调用Wait的线程
+};
+
+#endif
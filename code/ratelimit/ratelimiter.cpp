@@ -0,0 +1,154 @@
+#include "ratelimiter.h"
+#include <arpa/inet.h>
+#include <stdlib.h>
+
+using namespace std;
+
+RateLimiter* RateLimiter::limiterptr = new RateLimiter;
+
+RateLimiter::RateLimiter()
+    : ipRate_(0), ipBurst_(0), globalRate_(0), globalBurst_(0),
+      globalTokens_(0), globalStamp_(0), table_(nullptr), mask_(0), shift_(32) {}
+
+RateLimiter::~RateLimiter() {
+    delete[] table_;
+}
+
+RateLimiter* RateLimiter::Instance() {
+    return limiterptr;
+}
+
+static int64_t NowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RateLimiter::Init(double ipRate, double ipBurst, double globalRate, double globalBurst, int tableSize,
+                       const string& exempt) {
+    ipRate_ = ipRate;
+    ipBurst_ = ipBurst < 1 ? 1 : ipBurst;
+    globalRate_ = globalRate;
+    globalBurst_ = globalBurst < 1 ? 1 : globalBurst;
+    globalTokens_ = globalBurst_;
+    globalStamp_ = NowMs();
+    uint32_t size = PROBE_NUM;
+    int bits = 0;
+    while((1u << bits) < size) {
+        ++bits;
+    }
+    while(size < static_cast<uint32_t>(tableSize)) {
+        size <<= 1;
+        ++bits;
+    }
+    delete[] table_;
+    table_ = new Bucket[size];
+    memset(table_, 0, sizeof(Bucket) * size);
+    mask_ = size - 1;
+    shift_ = 32 - bits;
+    exempt_.clear();
+    size_t start = 0;
+    while(start < exempt.size()) {
+        size_t end = exempt.find(',', start);
+        if(end == string::npos) {
+            end = exempt.size();
+        }
+        string item = exempt.substr(start, end - start);
+        start = end + 1;
+        size_t b = item.find_first_not_of(" \t");
+        if(b == string::npos) {
+            continue;
+        }
+        item = item.substr(b, item.find_last_not_of(" \t") - b + 1);
+        int prefix = 32;
+        size_t slash = item.find('/');
+        if(slash != string::npos) {
+            prefix = atoi(item.c_str() + slash + 1);
+            item = item.substr(0, slash);
+        }
+        in_addr addr;
+        if(inet_pton(AF_INET, item.c_str(), &addr) != 1 || prefix < 0 || prefix > 32) {
+            LOG_WARN("rate_exempt: bad entry %s", item.c_str());
+            continue;
+        }
+        uint32_t mask = prefix == 0 ? 0 : 0xffffffffu << (32 - prefix);
+        exempt_.push_back(make_pair(ntohl(addr.s_addr) & mask, mask));
+    }
+}
+
+bool RateLimiter::Exempt_(uint32_t ip) const {
+    uint32_t host = ntohl(ip);
+    for(const auto& net : exempt_) {
+        if((host & net.second) == net.first) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool RateLimiter::Allow(const sockaddr_in& addr, int& retryAfter) {
+    retryAfter = 0;
+    int64_t now = NowMs();
+    uint32_t ip = addr.sin_addr.s_addr;
+    //配置了不限速的网段只跳过IP的桶，全局的桶照样扣
+    Bucket* bucket = nullptr;
+    if(ipRate_ > 0 && table_ && !Exempt_(ip)) {
+        bucket = Find_(ip, now);
+        //先只看IP的桶够不够，全局的桶也够时再一起扣，不能让被拒绝的连接白白用掉全局的令牌
+        float tokens = bucket->tokens;
+        int64_t stamp = bucket->stamp;
+        if(!Take_(tokens, stamp, now, ipRate_, ipBurst_, retryAfter)) {
+            bucket->tokens = tokens;
+            bucket->stamp = stamp;
+            LOG_DEBUG("rate limit ip %08x", ntohl(ip));
+            return false;
+        }
+    }
+    if(globalRate_ > 0 && !Take_(globalTokens_, globalStamp_, now, globalRate_, globalBurst_, retryAfter)) {
+        LOG_DEBUG("rate limit global");
+        return false;
+    }
+    if(bucket) {
+        Take_(bucket->tokens, bucket->stamp, now, ipRate_, ipBurst_, retryAfter);
+    }
+    return true;
+}
+
+bool RateLimiter::Take_(float& tokens, int64_t& stamp, int64_t now, double rate, double burst, int& retryAfter) {
+    double t = tokens + (now - stamp) * rate / 1000.0;
+    if(t > burst) {
+        t = burst;
+    }
+    stamp = now;
+    if(t >= 1.0) {
+        tokens = static_cast<float>(t - 1.0);
+        return true;
+    }
+    tokens = static_cast<float>(t);
+    //向上取整到秒，至少1秒
+    retryAfter = static_cast<int>((1.0 - t) / rate) + 1;
+    return false;
+}
+
+RateLimiter::Bucket* RateLimiter::Find_(uint32_t ip, int64_t now) {
+    //地址是网络字节序，低位是前两段，转成主机字节序后乘法哈希取高位，四段都参与
+    uint32_t pos = (ntohl(ip) * 2654435761u) >> shift_;
+    Bucket* victim = nullptr;
+    for(int i = 0; i < PROBE_NUM; ++i) {
+        Bucket* b = &table_[(pos + i) & mask_];
+        if(b->ip == ip) {
+            return b;
+        }
+        if(b->ip == 0) {
+            victim = b;
+            break;
+        }
+        if(!victim || b->stamp < victim->stamp) {
+            victim = b;
+        }
+    }
+    //新来的IP拿到一个满的桶
+    victim->ip = ip;
+    victim->tokens = static_cast<float>(ipBurst_);
+    victim->stamp = now;
+    return victim;
+}
@@ -0,0 +1,60 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "../log/log.h"
+
+//accept时的令牌桶限速，每个来源IP一个桶，另外还有一个全局的桶
+//IP的桶放在一个定长的开放寻址哈希表里，只探测几个位置，找不到空位就替换其中最久没用过的桶
+//被替换的IP下次来时拿到一个满的桶，相当于对很久没来的IP放宽了一点，内存不会随IP数量增长
+//可以配置不受IP限速的网段，比如压测机或者前面的反向代理，这些地址仍然要过全局的桶
+//只在主线程的accept循环里调用，不加锁
+class RateLimiter {
+public:
+    static RateLimiter* Instance();
+
+    //rate是每秒补充的令牌数，burst是桶的容量，rate<=0表示不限制，tableSize会向上取成2的幂
+    //exempt是逗号分隔的CIDR列表，比如"127.0.0.0/8,10.0.0.0/8"，空串表示没有
+    void Init(double ipRate, double ipBurst, double globalRate, double globalBurst, int tableSize,
+              const std::string& exempt);
+    //来自addr的新连接能否接受，能接受会消耗掉IP和全局的桶各一个令牌
+    //不能接受时retryAfter带出建议客户端多少秒后重试
+    bool Allow(const sockaddr_in& addr, int& retryAfter);
+
+private:
+    RateLimiter();
+    ~RateLimiter();
+
+    static const int PROBE_NUM = 8;//每个IP最多探测的位置数
+
+    struct Bucket {
+        uint32_t ip;//网络字节序，0表示空位
+        float tokens;
+        int64_t stamp;//上次补充令牌的时间，单位ms
+    };
+
+    //按经过的时间补充令牌，再看够不够一个，不够时算出还要等多久
+    static bool Take_(float& tokens, int64_t& stamp, int64_t now, double rate, double burst, int& retryAfter);
+    Bucket* Find_(uint32_t ip, int64_t now);
+    bool Exempt_(uint32_t ip) const;
+
+    double ipRate_;
+    double ipBurst_;
+    double globalRate_;
+    double globalBurst_;
+    float globalTokens_;
+    int64_t globalStamp_;
+    Bucket* table_;
+    uint32_t mask_;
+    int shift_;//乘法哈希的结果右移这么多位，剩下的高位就是表的下标
+    std::vector<std::pair<uint32_t, uint32_t>> exempt_;//不做IP限速的网段，主机字节序的网络号和掩码
+    static RateLimiter* limiterptr;
+};
+
+#endif //RATELIMITER_H
@@ -0,0 +1,134 @@
+/*
+请求路由
+路由表是一个constexpr数组，每条路由是(方法, 路径)对应一个处理函数，路径忽略大小写，可以是完整路径，也可以是前缀
+每条路由的哈希在编译期算好，再在编译期找一个乘数，让所有路由落在哈希表的不同位置，也就是一个编译期确定的完美哈希
+匹配时只把请求的路径过一遍算出哈希，在前缀路由的长度上顺便各查一次，最后查一次完整路径，每次查表只比较一个位置
+所以匹配的时间只和路径长度有关，路由再多，没有注册的静态页面也不会变慢，整个过程不拷贝字符串
+
+*/
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <strings.h>
+#include <stddef.h>
+
+//Handler是处理函数的类型，可以是成员函数指针或者函数指针，路由只负责找到它，不负责调用
+//Bits是哈希表的大小，2的Bits次方个位置，路由多到找不到乘数时FindSalt返回0，调大它就行
+template<typename Handler, int Bits = 5>
+class Router{
+
+public:
+    static const int SIZE = 1 << Bits;
+    static const uint32_t MAX_SALT = 255;//编译期最多试这么多个乘数，太多了会超过编译器constexpr的递归深度
+
+    struct Route{
+        int method;
+        const char* path;
+        size_t len;
+        bool prefix;//为true时只要路径以path开头就算匹配，完整路径的路由优先，前缀路由中长的优先
+        int lane;//由使用者自己解释，比如请求交给哪个线程池
+        Handler handler;
+        uint32_t hash;
+
+        constexpr Route(int m, const char* p, bool pre, int l, Handler h)
+            : method(m), path(p), len(Length(p)), prefix(pre), lane(l), handler(h), hash(Hash(p, Seed(m))) {}
+    };
+
+    //路由表必须比路由器活得久，一般就是静态的constexpr数组，salt是FindSalt找到的乘数
+    template<size_t N>
+    Router(const Route (&routes)[N], uint32_t salt);
+    //path不需要以\0结尾，找不到时返回空
+    const Route* Match(int method, const char* path, size_t len) const;
+
+    //FNV-1a，按小写字母计算，方法作为初始值的一部分，同一个路径不同方法的路由不会互相覆盖
+    static constexpr uint32_t Seed(int method) {
+        return (2166136261u ^ static_cast<uint32_t>(method)) * 16777619u;
+    }
+    static constexpr uint32_t Step(uint32_t h, char c) {
+        return (h ^ static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c)) * 16777619u;
+    }
+    static constexpr uint32_t Hash(const char* s, uint32_t h) {
+        return *s ? Hash(s + 1, Step(h, *s)) : h;
+    }
+    static constexpr size_t Length(const char* s) {
+        return *s ? 1 + Length(s + 1) : 0;
+    }
+    //乘法哈希，取乘积的高Bits位
+    static constexpr uint32_t Slot(uint32_t h, uint32_t salt) {
+        return static_cast<uint32_t>(h * salt) >> (32 - Bits);
+    }
+    //任意两条路由都不在同一个位置
+    static constexpr bool Perfect(const Route* routes, size_t n, uint32_t salt, size_t i = 0, size_t j = 1) {
+        return i >= n ? true
+             : j >= n ? Perfect(routes, n, salt, i + 1, i + 2)
+             : Slot(routes[i].hash, salt) != Slot(routes[j].hash, salt) && Perfect(routes, n, salt, i, j + 1);
+    }
+    //从小到大试奇数乘数，返回第一个没有冲突的，都不行时返回0，配合static_assert在编译期发现
+    static constexpr uint32_t FindSalt(const Route* routes, size_t n, uint32_t salt = 1) {
+        return salt > MAX_SALT ? 0
+             : Perfect(routes, n, salt) ? salt
+             : FindSalt(routes, n, salt + 2);
+    }
+
+private:
+    const Route* Probe_(int method, const char* path, size_t len, uint32_t h, bool prefix) const;
+
+    const Route* m_slots[SIZE];
+    uint32_t m_salt;
+    uint64_t m_prefix_lens;//第k位为1表示有长度为k的前缀路由，只有这些长度上需要查前缀
+    size_t m_max_prefix;//最长的前缀路由的长度
+};
+
+template<typename Handler, int Bits>
+template<size_t N>
+Router<Handler, Bits>::Router(const Route (&routes)[N], uint32_t salt) : m_salt(salt), m_prefix_lens(0), m_max_prefix(0) {
+    for(int i = 0; i < SIZE; ++i) {
+        m_slots[i] = nullptr;
+    }
+    for(size_t i = 0; i < N; ++i) {
+        m_slots[Slot(routes[i].hash, m_salt)] = &routes[i];
+        if(routes[i].prefix && routes[i].len < 64) {
+            m_prefix_lens |= 1ull << routes[i].len;
+            m_max_prefix = routes[i].len > m_max_prefix ? routes[i].len : m_max_prefix;
+        }
+    }
+}
+
+template<typename Handler, int Bits>
+const typename Router<Handler, Bits>::Route* Router<Handler, Bits>::Match(int method, const char* path, size_t len) const {
+    uint32_t h = Seed(method);
+    const Route* longest = nullptr;
+    //前缀路由的长度以内每一步都要看要不要查表，之后只算哈希
+    size_t i = 0;
+    size_t head = len < m_max_prefix ? len : m_max_prefix;
+    while(i < head) {
+        h = Step(h, path[i]);
+        ++i;
+        if(m_prefix_lens >> i & 1) {
+            const Route* route = Probe_(method, path, i, h, true);
+            if(route) {
+                longest = route;
+            }
+        }
+    }
+    for(; i < len; ++i) {
+        h = Step(h, path[i]);
+    }
+    const Route* exact = Probe_(method, path, len, h, false);
+    return exact ? exact : longest;
+}
+
+template<typename Handler, int Bits>
+const typename Router<Handler, Bits>::Route* Router<Handler, Bits>::Probe_(int method, const char* path, size_t len, uint32_t h, bool prefix) const {
+    const Route* route = m_slots[Slot(h, m_salt)];
+    //哈希相同还要再比一次，不在路由表里的路径也可能落到这个位置
+    if(route && route->hash == h && route->len == len && route->prefix == prefix &&
+       route->method == method && strncasecmp(route->path, path, len) == 0) {
+        return route;
+    }
+    return nullptr;
+}
+
+#endif
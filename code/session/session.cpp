@@ -0,0 +1,131 @@
+#include "session.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+//生成会话管理的单例
+SessionManager* SessionManager::sessionptr = new SessionManager;
+
+SessionManager::SessionManager() {
+    ttlMs_ = 0;
+    maxShardSessions_ = 0;
+    randomFd_ = -1;
+}
+
+SessionManager::~SessionManager() {
+    if(randomFd_ >= 0) {
+        close(randomFd_);
+    }
+}
+
+SessionManager* SessionManager::Instance() {
+    return sessionptr;
+}
+
+void SessionManager::Init(int ttlMs, int maxSessions) {
+    assert(ttlMs > 0 && maxSessions > 0);
+    ttlMs_ = ttlMs;
+    maxShardSessions_ = maxSessions > SHARD_NUM ? maxSessions / SHARD_NUM : 1;
+    if(randomFd_ < 0) {
+        randomFd_ = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if(randomFd_ < 0) {
+            LOG_ERROR("open /dev/urandom error");
+        }
+    }
+}
+
+SessionManager::Shard& SessionManager::GetShard_(const std::string& sessionId) {
+    return shards_[hash<string>()(sessionId) % SHARD_NUM];
+}
+
+bool SessionManager::GenerateId_(std::string& sessionId) {
+    static const char hex[] = "0123456789abcdef";
+    unsigned char bytes[SESSION_ID_LEN / 2];
+    if(randomFd_ < 0 || read(randomFd_, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) {
+        return false;
+    }
+    sessionId.resize(SESSION_ID_LEN);
+    for(int i = 0; i < SESSION_ID_LEN / 2; ++i) {
+        sessionId[i * 2] = hex[bytes[i] >> 4];
+        sessionId[i * 2 + 1] = hex[bytes[i] & 0xf];
+    }
+    return true;
+}
+
+std::string SessionManager::Create(const std::string& username) {
+    std::string sessionId;
+    if(ttlMs_ <= 0 || !GenerateId_(sessionId)) {
+        LOG_ERROR("session create error");
+        return "";
+    }
+    Shard& shard = GetShard_(sessionId);
+    lock_guard<mutex> locker(shard.mtx);
+    if(shard.sessions.size() >= maxShardSessions_) {
+        //分片满了就拒绝新会话，用户仍然可以通过登陆访问，只是不能免登陆
+        LOG_WARN("session shard is full!");
+        return "";
+    }
+    SessionNode& node = shard.sessions[sessionId];
+    node.username = username;
+    node.expires = chrono::steady_clock::now() + chrono::milliseconds(ttlMs_);
+    return sessionId;
+}
+
+bool SessionManager::Validate(const std::string& sessionId, std::string* username) {
+    if(sessionId.size() != SESSION_ID_LEN) {
+        return false;
+    }
+    Shard& shard = GetShard_(sessionId);
+    lock_guard<mutex> locker(shard.mtx);
+    auto it = shard.sessions.find(sessionId);
+    if(it == shard.sessions.end()) {
+        return false;
+    }
+    auto now = chrono::steady_clock::now();
+    if(it->second.expires <= now) {
+        shard.sessions.erase(it);
+        return false;
+    }
+    it->second.expires = now + chrono::milliseconds(ttlMs_);//访问一次就延长一次
+    if(username) {
+        *username = it->second.username;
+    }
+    return true;
+}
+
+void SessionManager::Remove(const std::string& sessionId) {
+    Shard& shard = GetShard_(sessionId);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.sessions.erase(sessionId);
+}
+
+void SessionManager::Sweep() {
+    auto now = chrono::steady_clock::now();
+    size_t removed = 0;
+    //一个分片一个分片的清理，不会长时间挡住所有工作线程
+    for(int i = 0; i < SHARD_NUM; ++i) {
+        lock_guard<mutex> locker(shards_[i].mtx);
+        auto& sessions = shards_[i].sessions;
+        for(auto it = sessions.begin(); it != sessions.end();) {
+            if(it->second.expires <= now) {
+                it = sessions.erase(it);
+                ++removed;
+            } else {
+                ++it;
+            }
+        }
+    }
+    if(removed > 0) {
+        LOG_DEBUG("session sweep removed %d", (int)removed);
+    }
+}
+
+size_t SessionManager::Count() {
+    size_t count = 0;
+    for(int i = 0; i < SHARD_NUM; ++i) {
+        lock_guard<mutex> locker(shards_[i].mtx);
+        count += shards_[i].sessions.size();
+    }
+    return count;
+}
@@ -0,0 +1,62 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <unordered_map>
+
+#include "../log/log.h"
+
+//会话管理，登陆成功后给客户端发一个不透明的随机cookie
+//之后带着cookie的GET请求只需要查一次哈希表就能确认身份，不再需要访问mysql
+//按会话id分成多个分片，每个分片一把锁，过期的会话由时间堆的周期任务调用Sweep清理
+class SessionManager {
+public:
+    static const int SESSION_ID_LEN = 32;//会话id长度，16个随机字节的十六进制
+
+    static SessionManager* Instance();
+
+    //ttlMs是会话在没有访问时的存活时间，maxSessions是最多保存的会话数量
+    void Init(int ttlMs, int maxSessions);
+    //为登陆成功的用户创建会话，返回会话id，失败返回空字符串
+    std::string Create(const std::string& username);
+    //检查会话是否有效，有效会顺便延长过期时间，username不为空时会带出用户名
+    bool Validate(const std::string& sessionId, std::string* username = nullptr);
+    //删除一个会话
+    void Remove(const std::string& sessionId);
+    //清理所有过期的会话，由主线程的时间堆周期性调用
+    void Sweep();
+    //当前会话数量
+    size_t Count();
+
+private:
+    SessionManager();
+    ~SessionManager();
+
+    static const int SHARD_NUM = 16;//分片数量
+
+    struct SessionNode {
+        std::string username;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, SessionNode> sessions;
+    };
+
+    Shard& GetShard_(const std::string& sessionId);
+    //生成随机的会话id
+    bool GenerateId_(std::string& sessionId);
+
+    int ttlMs_;
+    size_t maxShardSessions_;//每个分片最多保存的会话数量
+    int randomFd_;///dev/urandom，会话id必须不可预测
+    Shard shards_[SHARD_NUM];
+
+private:
+    static SessionManager* sessionptr;
+};
+
+#endif //SESSION_H
@@ -0,0 +1,125 @@
+#include "sha256.h"
+#include <string.h>
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t Rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+}
+
+Sha256::Sha256() {
+    Reset();
+}
+
+void Sha256::Reset() {
+    state_[0] = 0x6a09e667; state_[1] = 0xbb67ae85;
+    state_[2] = 0x3c6ef372; state_[3] = 0xa54ff53a;
+    state_[4] = 0x510e527f; state_[5] = 0x9b05688c;
+    state_[6] = 0x1f83d9ab; state_[7] = 0x5be0cd19;
+    bitLen_ = 0;
+    blockLen_ = 0;
+}
+
+void Sha256::Transform_(const uint8_t block[64]) {
+    uint32_t w[64];
+    for(int i = 0; i < 16; ++i) {
+        w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+               (uint32_t)block[i * 4 + 2] << 8 | (uint32_t)block[i * 4 + 3];
+    }
+    for(int i = 16; i < 64; ++i) {
+        uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for(int i = 0; i < 64; ++i) {
+        uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + K[i] + w[i];
+        uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    state_[0] += a; state_[1] += b; state_[2] += c; state_[3] += d;
+    state_[4] += e; state_[5] += f; state_[6] += g; state_[7] += h;
+}
+
+void Sha256::Update(const void* data, size_t len) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    bitLen_ += (uint64_t)len * 8;
+    //先把上次剩下的不满一块的数据补满
+    if(blockLen_ > 0) {
+        size_t n = 64 - blockLen_ < len ? 64 - blockLen_ : len;
+        memcpy(block_ + blockLen_, p, n);
+        blockLen_ += n;
+        p += n;
+        len -= n;
+        if(blockLen_ < 64) {
+            return;
+        }
+        Transform_(block_);
+        blockLen_ = 0;
+    }
+    //完整的块直接计算，不用拷贝
+    while(len >= 64) {
+        Transform_(p);
+        p += 64;
+        len -= 64;
+    }
+    memcpy(block_, p, len);
+    blockLen_ = len;
+}
+
+void Sha256::Final(uint8_t digest[DIGEST_LEN]) {
+    uint64_t bitLen = bitLen_;
+    //补一个1，再补0直到剩下8字节放长度
+    uint8_t pad[72] = { 0x80 };
+    size_t padLen = blockLen_ < 56 ? 56 - blockLen_ : 120 - blockLen_;
+    Update(pad, padLen);
+    uint8_t lenBytes[8];
+    for(int i = 0; i < 8; ++i) {
+        lenBytes[i] = (uint8_t)(bitLen >> (56 - i * 8));
+    }
+    Update(lenBytes, 8);
+    for(int i = 0; i < 8; ++i) {
+        digest[i * 4] = (uint8_t)(state_[i] >> 24);
+        digest[i * 4 + 1] = (uint8_t)(state_[i] >> 16);
+        digest[i * 4 + 2] = (uint8_t)(state_[i] >> 8);
+        digest[i * 4 + 3] = (uint8_t)state_[i];
+    }
+    Reset();
+}
+
+std::string Sha256::HexDigest(const void* data, size_t len) {
+    Sha256 sha;
+    uint8_t digest[DIGEST_LEN];
+    sha.Update(data, len);
+    sha.Final(digest);
+    return ToHex(digest, DIGEST_LEN);
+}
+
+std::string Sha256::ToHex(const uint8_t* digest, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    std::string res(len * 2, '0');
+    for(size_t i = 0; i < len; ++i) {
+        res[i * 2] = hex[digest[i] >> 4];
+        res[i * 2 + 1] = hex[digest[i] & 0xf];
+    }
+    return res;
+}
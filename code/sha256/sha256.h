@@ -0,0 +1,35 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+//SHA-256摘要，可以一次性计算，也可以分段Update，适合边接收边计算
+class Sha256 {
+public:
+    static const int DIGEST_LEN = 32;//摘要长度，字节
+
+    Sha256();
+    //重新开始一次计算
+    void Reset();
+    //追加要计算的数据，可以多次调用
+    void Update(const void* data, size_t len);
+    //结束计算，把32字节的摘要写入digest
+    void Final(uint8_t digest[DIGEST_LEN]);
+
+    //一次性计算，返回64个字符的十六进制摘要
+    static std::string HexDigest(const void* data, size_t len);
+    //把摘要转成十六进制字符串
+    static std::string ToHex(const uint8_t* digest, size_t len);
+
+private:
+    void Transform_(const uint8_t block[64]);
+
+    uint32_t state_[8];
+    uint64_t bitLen_;//已经处理的数据长度，单位是bit
+    uint8_t block_[64];//还不满64字节的数据先放在这里
+    size_t blockLen_;
+};
+
+#endif //SHA256_H
@@ -0,0 +1,78 @@
+/*
+对象的slab分配器
+一次向系统申请一整块(chunk)对象，用完放回空闲链表，下次直接复用，不再归还给系统
+块是用到时才申请的，启动时不占内存
+对象的内存不会被释放，所以别的线程拿着旧指针也不会访问到非法内存，需要自己判断对象是否已经被复用
+
+*/
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <vector>
+#include <assert.h>
+#include "../log/log.h"
+
+//T必须有默认构造函数，放回时不析构，复用时由使用者自己重新初始化
+template<typename T>
+class Slab{
+
+public:
+    Slab(int chunk_size = 64);
+    ~Slab();
+    //取一个对象，空闲链表为空时再申请一块
+    T* Alloc();
+    //把对象放回空闲链表
+    void Free(T* obj);
+    //正在使用的对象数量
+    size_t InUse() const { return m_in_use; }
+    //已经申请的对象总数
+    size_t Capacity() const { return m_chunks.size() * m_chunk_size; }
+
+private:
+    Slab(const Slab&);
+    Slab& operator=(const Slab&);
+
+    int m_chunk_size;//每块的对象数量
+    std::vector<T*> m_chunks;//所有申请过的块
+    std::vector<T*> m_free_list;//空闲对象，从尾部取放，最近用过的对象还在缓存里
+    size_t m_in_use;
+};
+
+template<typename T>
+Slab<T>::Slab(int chunk_size):m_chunk_size(chunk_size),m_in_use(0){
+    assert(chunk_size > 0);
+}
+
+template<typename T>
+Slab<T>::~Slab(){
+    for(T* chunk : m_chunks){
+        delete[] chunk;
+    }
+}
+
+template<typename T>
+T* Slab<T>::Alloc(){
+    if(m_free_list.empty()){
+        T* chunk = new T[m_chunk_size];
+        m_chunks.push_back(chunk);
+        //倒着放进去，先取到块里靠前的对象
+        for(int i = m_chunk_size - 1; i >= 0; --i){
+            m_free_list.push_back(chunk + i);
+        }
+        LOG_DEBUG("slab grow to %d objects", (int)Capacity());
+    }
+    T* obj = m_free_list.back();
+    m_free_list.pop_back();
+    ++m_in_use;
+    return obj;
+}
+
+template<typename T>
+void Slab<T>::Free(T* obj){
+    assert(obj && m_in_use > 0);
+    m_free_list.push_back(obj);
+    --m_in_use;
+}
+
+#endif
@@ -6,27 +6,28 @@ void Setnonblocking(int fd){
     fcntl(fd,F_SETFL,flag);
 
 }
-void Addfd(int epollfd,int fd,bool et,bool one_shot){
-    struct epoll_event epev;
-    epev.events = EPOLLIN  | EPOLLRDHUP |EPOLLHUP;
+void Addfd(Poller* poller,int fd,bool et,bool one_shot,bool nonblock){
+    uint32_t events = EPOLLIN  | EPOLLRDHUP |EPOLLHUP;
     if(et){
-        epev.events|= EPOLLET;
+        events|= EPOLLET;
     }
     if(one_shot){
-        epev.events |= EPOLLONESHOT;
+        events |= EPOLLONESHOT;
     }
-    epev.data.fd = fd;
-    epoll_ctl(epollfd,EPOLL_CTL_ADD,fd,&epev);
-    Setnonblocking(fd);
+    poller->Add(fd,events);
+    if(nonblock){
+        Setnonblocking(fd);
+    }
+}
+
+void Removefd(Poller* poller,int fd){
+    poller->Del(fd);
 }
 
-void Removefd(int epollfd,int fd){
-    epoll_ctl(epollfd,EPOLL_CTL_DEL,fd,0);
+void Forgetfd(Poller* poller,int fd){
+    poller->Forget(fd);
 }
 
-void Modfd(int epollfd,int fd,int event){
-    struct epoll_event epev;
-    epev.events = event | EPOLLET | EPOLLRDHUP |EPOLLHUP| EPOLLONESHOT;
-    epev.data.fd = fd;
-    epoll_ctl(epollfd,EPOLL_CTL_MOD,fd,&epev);
+void Modfd(Poller* poller,int fd,int event){
+    poller->Mod(fd,event | EPOLLET | EPOLLRDHUP |EPOLLHUP| EPOLLONESHOT);
 }
\ No newline at end of file
@@ -9,16 +9,21 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <signal.h>
+#include "../poller/poller.h"
 
 
 
 
 void Setnonblocking(int fd);
 
-void Addfd(int epollfd,int fd,bool et,bool one_shot);
+//nonblock为false时不再设置非阻塞，accept4已经设置过的套接字不用再调用两次fcntl
+void Addfd(Poller* poller,int fd,bool et,bool one_shot,bool nonblock = true);
 
-void Removefd(int epollfd,int fd);
+void Removefd(Poller* poller,int fd);
 
-void Modfd(int epollfd,int fd,int event);
+//描述符马上要关闭时用，epoll后端不需要系统调用
+void Forgetfd(Poller* poller,int fd);
+
+void Modfd(Poller* poller,int fd,int event);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,492 @@
+#include "asyncsql.h"
+using namespace std;
+
+//生成异步数据库的单例
+AsyncSql* AsyncSql::asyncptr = new AsyncSql;
+
+AsyncSql::AsyncSql() {
+    isOpen_ = false;
+    poller_ = nullptr;
+    wakeFd_ = -1;
+    port_ = 0;
+    stepTimeoutMs_ = 3000;
+}
+
+AsyncSql::~AsyncSql() {
+    Close();
+}
+
+AsyncSql* AsyncSql::Instance() {
+    return asyncptr;
+}
+
+bool AsyncSql::Owns(int fd) {
+    return isOpen_ && (fd == wakeFd_ || fdMap_.count(fd) > 0);
+}
+
+bool AsyncSql::Submit(JOB_TYPE type, const std::string& name, const std::string& pwd, const Callback& cb) {
+    if(!isOpen_) {
+        return false;
+    }
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(jobQue_.size() >= MAX_PENDING_JOBS) {//数据库跟不上了，让调用者稍后重试或者同步查询
+            return false;
+        }
+        jobQue_.push_back({type, name, pwd, cb, false});
+    }
+    //唤醒主线程的事件等待，由主线程分配连接
+    uint64_t one = 1;
+    if(write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+        LOG_ERROR("AsyncSql wake error");
+    }
+    return true;
+}
+
+#ifdef ASYNC_SQL_SUPPORTED
+
+bool AsyncSql::Init(const char* host, int port,
+                    const char* user, const char* pwd,
+                    const char* dbName, int connSize, Poller* poller, int stepTimeoutMs) {
+    assert(connSize > 0);
+    host_ = host;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    port_ = port;
+    poller_ = poller;
+    stepTimeoutMs_ = stepTimeoutMs > 0 ? stepTimeoutMs : 3000;
+
+    wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(wakeFd_ < 0) {
+        LOG_ERROR("AsyncSql eventfd error");
+        return false;
+    }
+    poller_->Add(wakeFd_, EPOLLIN);
+
+    int connected = 0;
+    conns_.resize(connSize);
+    for(AsyncConn& conn : conns_) {
+        conn.fd = -1;
+        conn.step = STEP_IDLE;
+        conn.waiting = false;
+        conn.err = 0;
+        conn.connRet = nullptr;
+        for(int i = 0; i < SqlConnPool::STMT_COUNT; ++i) {
+            conn.stmts[i] = nullptr;
+        }
+        conn.current = SqlConnPool::STMT_LOGIN;
+        conn.stepDeadline = 0;
+        conn.libDeadline = 0;
+        conn.sql = mysql_init(nullptr);
+        if(!conn.sql) {
+            LOG_ERROR("MySql init error!");
+            conn.broken = true;
+            continue;
+        }
+        mysql_options(conn.sql, MYSQL_OPT_NONBLOCK, 0);
+        //启动时用阻塞的方式先连上，断开后再用非阻塞的方式重连
+        conn.broken = mysql_real_connect(conn.sql, host, user, pwd, dbName, port, nullptr, 0) == nullptr;
+        if(conn.broken) {
+            LOG_ERROR("MySql Connect error!");
+        } else {
+            ++connected;
+        }
+    }
+    isOpen_ = true;
+    LOG_INFO("AsyncSql init, %d/%d connected, step timeout %dms", connected, connSize, stepTimeoutMs_);
+    return true;
+}
+
+void AsyncSql::HandleEvent(int fd, uint32_t events) {
+    if(fd == wakeFd_) {
+        uint64_t count;
+        while(read(wakeFd_, &count, sizeof(count)) > 0) {}
+        Dispatch_();
+        return;
+    }
+    auto it = fdMap_.find(fd);
+    if(it == fdMap_.end()) {
+        return;
+    }
+    AsyncConn& conn = conns_[it->second];
+    if(conn.step == STEP_IDLE || !conn.waiting) {
+        return;
+    }
+    int event = 0;
+    if(events & EPOLLIN) { event |= MYSQL_WAIT_READ; }
+    if(events & EPOLLOUT) { event |= MYSQL_WAIT_WRITE; }
+    if(events & EPOLLPRI) { event |= MYSQL_WAIT_EXCEPT; }
+    if(events & (EPOLLERR | EPOLLHUP)) { event |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE; }//让客户端库自己发现错误
+    Advance_(conn, event);
+    Dispatch_();
+}
+
+int AsyncSql::Tick() {
+    if(!isOpen_) {
+        return -1;
+    }
+    int64_t now = NowMs_();
+    int64_t next = -1;
+    bool finished = false;
+    for(AsyncConn& conn : conns_) {
+        if(conn.step == STEP_IDLE || !conn.waiting) {
+            continue;
+        }
+        if(conn.stepDeadline <= now) {
+            //服务器或者网络卡住了，连接停在协议的中间，只能断开后重连
+            LOG_WARN("AsyncSql step %d timeout after %dms", conn.step, stepTimeoutMs_);
+            conn.broken = true;
+            Finish_(conn, false);
+            finished = true;
+            continue;
+        }
+        if(conn.libDeadline && conn.libDeadline <= now) {
+            //客户端库自己的超时到了，告诉它超时，由它决定下一步
+            conn.libDeadline = 0;
+            Advance_(conn, MYSQL_WAIT_TIMEOUT);
+            finished = true;
+            if(conn.step == STEP_IDLE || !conn.waiting) {
+                continue;
+            }
+        }
+        int64_t deadline = conn.libDeadline && conn.libDeadline < conn.stepDeadline ? conn.libDeadline : conn.stepDeadline;
+        if(next < 0 || deadline < next) {
+            next = deadline;
+        }
+    }
+    if(finished) {
+        Dispatch_();
+    }
+    return next < 0 ? -1 : static_cast<int>(next - now);
+}
+
+void AsyncSql::Dispatch_() {
+    for(AsyncConn& conn : conns_) {
+        if(conn.step != STEP_IDLE) {
+            continue;
+        }
+        {
+            lock_guard<mutex> locker(mtx_);
+            if(jobQue_.empty()) {
+                return;
+            }
+            conn.job = std::move(jobQue_.front());
+            jobQue_.pop_front();
+        }
+        conn.waiting = false;
+        if(conn.broken) {//断开的连接先非阻塞的重连
+            if(!Reconnect_(conn)) {
+                Finish_(conn, false);
+                continue;
+            }
+        } else if(!Begin_(conn, SqlConnPool::STMT_LOGIN)) {
+            Finish_(conn, false);
+            continue;
+        }
+        Advance_(conn, 0);
+    }
+}
+
+bool AsyncSql::Begin_(AsyncConn& conn, SqlConnPool::SQL_STMT type) {
+    conn.current = type;
+    if(!conn.stmts[type]) {
+        //第一次在这个连接上用，mysql_stmt_init只分配内存，prepare要和服务器往返
+        conn.stmts[type] = mysql_stmt_init(conn.sql);
+        if(!conn.stmts[type]) {
+            LOG_ERROR("mysql_stmt_init() error");
+            return false;
+        }
+        conn.step = STEP_PREPARE;
+        return true;
+    }
+    MYSQL_STMT* stmt = conn.stmts[type];
+    conn.nameLen = conn.job.name.size();
+    conn.pwdLen = conn.job.pwd.size();
+    memset(conn.param, 0, sizeof(conn.param));
+    conn.param[0].buffer_type = MYSQL_TYPE_STRING;
+    conn.param[0].buffer = const_cast<char*>(conn.job.name.data());
+    conn.param[0].buffer_length = conn.nameLen;
+    conn.param[0].length = &conn.nameLen;
+    if(type == SqlConnPool::STMT_LOGIN) {
+        memset(conn.result, 0, sizeof(conn.result));
+        conn.result[0].buffer_type = MYSQL_TYPE_STRING;
+        conn.result[0].buffer = conn.password;
+        conn.result[0].buffer_length = PASSWORD_LEN;
+        conn.result[0].length = &conn.passwordLen;
+        if(mysql_stmt_bind_param(stmt, conn.param) || mysql_stmt_bind_result(stmt, conn.result)) {
+            LOG_ERROR("login stmt bind error: %s", mysql_stmt_error(stmt));
+            return false;
+        }
+        conn.step = STEP_SELECT;
+    } else {
+        conn.param[1].buffer_type = MYSQL_TYPE_STRING;
+        conn.param[1].buffer = const_cast<char*>(conn.job.pwd.data());
+        conn.param[1].buffer_length = conn.pwdLen;
+        conn.param[1].length = &conn.pwdLen;
+        if(mysql_stmt_bind_param(stmt, conn.param)) {
+            LOG_ERROR("register stmt bind error: %s", mysql_stmt_error(stmt));
+            return false;
+        }
+        conn.step = STEP_INSERT;
+    }
+    return true;
+}
+
+void AsyncSql::Advance_(AsyncConn& conn, int event) {
+    while(true) {
+        int status = 0;
+        MYSQL_STMT* stmt = conn.stmts[conn.current];
+        if(!conn.waiting) {//新的一步，重新开始计时
+            conn.stepDeadline = NowMs_() + stepTimeoutMs_;
+            conn.libDeadline = 0;
+        }
+        switch(conn.step) {
+        case STEP_CONNECT:
+            status = conn.waiting ? mysql_real_connect_cont(&conn.connRet, conn.sql, event)
+                                  : mysql_real_connect_start(&conn.connRet, conn.sql, host_.c_str(), user_.c_str(),
+                                                             pwd_.c_str(), dbName_.c_str(), port_, nullptr, 0);
+            break;
+        case STEP_PREPARE: {
+            const char* query = SqlConnPool::STMT_SQL[conn.current];
+            status = conn.waiting ? mysql_stmt_prepare_cont(&conn.err, stmt, event)
+                                  : mysql_stmt_prepare_start(&conn.err, stmt, query, strlen(query));
+            break;
+        }
+        case STEP_SELECT:
+        case STEP_INSERT:
+            status = conn.waiting ? mysql_stmt_execute_cont(&conn.err, stmt, event)
+                                  : mysql_stmt_execute_start(&conn.err, stmt);
+            break;
+        case STEP_STORE:
+            status = conn.waiting ? mysql_stmt_store_result_cont(&conn.err, stmt, event)
+                                  : mysql_stmt_store_result_start(&conn.err, stmt);
+            break;
+        default:
+            return;
+        }
+        if(status) {//还没完成，等套接字上的事件，主线程继续处理别的连接
+            conn.waiting = true;
+            Arm_(conn, status);
+            return;
+        }
+        //这一步完成了
+        conn.waiting = false;
+        conn.libDeadline = 0;
+        event = 0;
+        if(!NextStep_(conn)) {
+            return;
+        }
+    }
+}
+
+bool AsyncSql::NextStep_(AsyncConn& conn) {
+    MYSQL_STMT* stmt = conn.stmts[conn.current];
+    switch(conn.step) {
+    case STEP_CONNECT:
+        if(!conn.connRet) {
+            LOG_ERROR("MySql reconnect error: %s", mysql_error(conn.sql));
+            conn.broken = true;
+            Finish_(conn, false);
+            return false;
+        }
+        conn.broken = false;
+        if(!Begin_(conn, SqlConnPool::STMT_LOGIN)) {
+            Finish_(conn, false);
+            return false;
+        }
+        return true;
+    case STEP_PREPARE:
+        if(conn.err) {
+            //语句丢掉，下次重新prepare
+            LOG_ERROR("mysql_stmt_prepare() error: %s", mysql_stmt_error(stmt));
+            mysql_stmt_close(stmt);
+            conn.stmts[conn.current] = nullptr;
+            conn.broken = mysql_errno(conn.sql) != 0;
+            Finish_(conn, false);
+            return false;
+        }
+        if(!Begin_(conn, conn.current)) {
+            Finish_(conn, false);
+            return false;
+        }
+        return true;
+    case STEP_SELECT:
+        if(conn.err) {
+            LOG_ERROR("MySql select error: %s", mysql_stmt_error(stmt));
+            if(!conn.job.retried && Reconnect_(conn)) {//查询不改数据，重连后可以放心重试
+                conn.job.retried = true;
+                return true;
+            }
+            conn.broken = true;
+            Finish_(conn, false);
+            return false;
+        }
+        conn.step = STEP_STORE;
+        return true;
+    case STEP_STORE: {
+        if(conn.err) {
+            LOG_ERROR("MySql store result error: %s", mysql_stmt_error(stmt));
+            conn.broken = true;
+            Finish_(conn, false);
+            return false;
+        }
+        //结果已经全部取回本地，取行和释放结果都不会再读套接字
+        int ret = mysql_stmt_fetch(stmt);
+        bool found = ret == 0 || ret == MYSQL_DATA_TRUNCATED;
+        bool whole = ret == 0;//被截断的密码不缓存，也一定不会相等
+        std::string password(conn.password, whole ? conn.passwordLen : 0);
+        while(ret == 0 || ret == MYSQL_DATA_TRUNCATED) {
+            ret = mysql_stmt_fetch(stmt);
+        }
+        mysql_stmt_free_result(stmt);
+        if(!found) {
+            AuthCache::Instance()->PutNoUser(conn.job.name);
+        } else if(whole) {
+            AuthCache::Instance()->Put(conn.job.name, password);
+        }
+        if(conn.job.type == JOB_LOGIN) {
+            Finish_(conn, whole && password == conn.job.pwd);
+            return false;
+        }
+        if(found) {//注册但是用户已经存在
+            LOG_DEBUG("user used!");
+            Finish_(conn, false);
+            return false;
+        }
+        if(!Begin_(conn, SqlConnPool::STMT_REGISTER)) {
+            Finish_(conn, false);
+            return false;
+        }
+        return true;
+    }
+    case STEP_INSERT:
+        if(conn.err) {
+            LOG_DEBUG("Insert error: %s", mysql_stmt_error(stmt));
+            Finish_(conn, false);
+            return false;
+        }
+        AuthCache::Instance()->Invalidate(conn.job.name);//插入了新用户，负缓存要失效
+        Finish_(conn, true);
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool AsyncSql::Reconnect_(AsyncConn& conn) {
+    CloseConn_(conn);
+    conn.sql = mysql_init(nullptr);
+    if(!conn.sql) {
+        LOG_ERROR("MySql init error!");
+        conn.broken = true;
+        return false;
+    }
+    mysql_options(conn.sql, MYSQL_OPT_NONBLOCK, 0);
+    conn.step = STEP_CONNECT;
+    conn.waiting = false;
+    return true;
+}
+
+void AsyncSql::Arm_(AsyncConn& conn, int status) {
+    int sock = mysql_get_socket(conn.sql);
+    uint32_t events = EPOLLONESHOT;
+    if(status & MYSQL_WAIT_READ) { events |= EPOLLIN; }
+    if(status & MYSQL_WAIT_WRITE) { events |= EPOLLOUT; }
+    if(status & MYSQL_WAIT_EXCEPT) { events |= EPOLLPRI; }
+    if(status & MYSQL_WAIT_TIMEOUT) {
+        //客户端库自己的超时，由Tick到期后用MYSQL_WAIT_TIMEOUT继续
+        conn.libDeadline = NowMs_() + mysql_get_timeout_value(conn.sql) * 1000;
+    }
+    if(sock < 0 || (events == EPOLLONESHOT && !conn.libDeadline)) {
+        LOG_ERROR("AsyncSql unexpected wait status %d", status);
+        conn.broken = true;
+        conn.waiting = false;
+        Finish_(conn, false);
+        return;
+    }
+    if(events == EPOLLONESHOT) {//只等超时，不用监听套接字
+        return;
+    }
+    if(conn.fd == sock) {
+        poller_->Mod(sock, events);
+        return;
+    }
+    //重连后套接字变了，重新注册
+    Unregister_(conn);
+    poller_->Add(sock, events);
+    conn.fd = sock;
+    fdMap_[sock] = &conn - &conns_[0];
+}
+
+void AsyncSql::Unregister_(AsyncConn& conn) {
+    if(conn.fd >= 0) {
+        poller_->Del(conn.fd);
+        fdMap_.erase(conn.fd);
+        conn.fd = -1;
+    }
+}
+
+void AsyncSql::CloseConn_(AsyncConn& conn) {
+    Unregister_(conn);
+    if(conn.sql) {
+        mysql_close(conn.sql);
+        conn.sql = nullptr;
+    }
+    //先关连接，连接上的语句随之失效，mysql_stmt_close只释放内存，不会再读写可能已经卡住的套接字
+    for(int i = 0; i < SqlConnPool::STMT_COUNT; ++i) {
+        if(conn.stmts[i]) {
+            mysql_stmt_close(conn.stmts[i]);
+            conn.stmts[i] = nullptr;
+        }
+    }
+}
+
+void AsyncSql::Finish_(AsyncConn& conn, bool ok) {
+    Callback cb;
+    cb.swap(conn.job.cb);
+    conn.job.name.clear();
+    conn.job.pwd.clear();
+    conn.step = STEP_IDLE;
+    conn.waiting = false;
+    conn.libDeadline = 0;
+    if(conn.broken) {//断开的连接先不在事件后端中监听，下次分配任务时重连
+        Unregister_(conn);
+    }
+    if(cb) {
+        cb(ok);
+    }
+}
+
+void AsyncSql::Close() {
+    isOpen_ = false;
+    for(AsyncConn& conn : conns_) {
+        CloseConn_(conn);
+    }
+    conns_.clear();
+    if(wakeFd_ >= 0) {
+        close(wakeFd_);
+        wakeFd_ = -1;
+    }
+}
+
+#else
+
+bool AsyncSql::Init(const char* host, int port,
+                    const char* user, const char* pwd,
+                    const char* dbName, int connSize, Poller* poller, int stepTimeoutMs) {
+    LOG_WARN("AsyncSql needs the MariaDB client library, fall back to SqlConnPool");
+    return false;
+}
+
+void AsyncSql::HandleEvent(int fd, uint32_t events) {}
+
+int AsyncSql::Tick() {
+    return -1;
+}
+
+void AsyncSql::Close() {
+    isOpen_ = false;
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef ASYNCSQL_H
+#define ASYNCSQL_H
+
+#include <mysql/mysql.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+
+#include "../log/log.h"
+#include "../authcache/authcache.h"
+#include "../poller/poller.h"
+#include "sqlconnpool.h"
+
+//非阻塞的mysql接口(mysql_stmt_execute_start/_cont等)只有MariaDB的客户端库才有
+#if defined(LIBMARIADB) || defined(MARIADB_BASE_VERSION)
+#define ASYNC_SQL_SUPPORTED 1
+#endif
+
+//异步数据库，登陆和注册的查询不再阻塞工作线程
+//工作线程把查询提交到队列后直接返回，主线程的事件后端同时监听数据库连接的套接字，
+//用非阻塞接口一步步推进查询，结果出来后在主线程调用回调，由回调把Http_Conn重新放回线程池继续处理
+//查询和同步的路径一样用预编译语句，用户名和密码作为参数绑定，每个连接上的语句第一次用到时非阻塞地prepare
+//每一步都有期限，超过期限的连接当作断开，任务失败，下次使用前重连
+class AsyncSql {
+public:
+    enum JOB_TYPE { JOB_LOGIN = 0, JOB_REGISTER };
+    //排队等待的任务上限，超过后Submit返回false
+    static const size_t MAX_PENDING_JOBS = 1024;
+    static const int PASSWORD_LEN = 64;//查询结果中密码的缓冲区大小，和同步的路径一致
+    //回调在主线程执行，ok是登陆或注册是否成功
+    typedef std::function<void(bool ok)> Callback;
+
+    static AsyncSql* Instance();
+
+    //建立connSize个非阻塞连接，并把唤醒用的eventfd加入主线程的事件后端
+    //客户端库不支持非阻塞接口或者一个连接都建不起来时返回false，此时继续使用同步的SqlConnPool
+    bool Init(const char* host, int port,
+              const char* user, const char* pwd,
+              const char* dbName, int connSize, Poller* poller, int stepTimeoutMs = 3000);
+    //是否可以使用异步数据库
+    bool IsOpen() { return isOpen_; }
+    //工作线程调用，提交一次登陆或注册，回调会在主线程执行
+    bool Submit(JOB_TYPE type, const std::string& name, const std::string& pwd, const Callback& cb);
+    //主线程调用，判断事件后端返回的fd是不是异步数据库的
+    bool Owns(int fd);
+    //主线程调用，处理异步数据库fd上的事件
+    void HandleEvent(int fd, uint32_t events);
+    //主线程每轮等待前调用，处理到期的步骤，返回离下一个期限还有多少ms，没有时返回-1
+    int Tick();
+    //关闭所有连接
+    void Close();
+
+private:
+    AsyncSql();
+    ~AsyncSql();
+
+    //每个连接上当前正在做的步骤
+    //IDLE:空闲  CONNECT:正在重连  PREPARE:预编译语句  SELECT:查询用户  STORE:取查询结果  INSERT:插入新用户
+    enum STEP { STEP_IDLE = 0, STEP_CONNECT, STEP_PREPARE, STEP_SELECT, STEP_STORE, STEP_INSERT };
+
+    struct Job {
+        JOB_TYPE type;
+        std::string name;
+        std::string pwd;
+        Callback cb;
+        bool retried;//空闲太久的连接会被服务器断开，查询失败时重连后再试一次
+    };
+
+    struct AsyncConn {
+        MYSQL* sql;
+        int fd;//当前在事件后端中注册的套接字，-1代表没有注册
+        bool broken;//连接是否已经断开，断开的连接下次使用前要重连
+        STEP step;
+        bool waiting;//当前步骤是否已经start，正在等待套接字事件后cont
+        int err;//语句各个步骤的返回值
+        MYSQL* connRet;//mysql_real_connect的返回值
+        MYSQL_STMT* stmts[SqlConnPool::STMT_COUNT];//连接上预编译好的语句，下标是SQL_STMT
+        SqlConnPool::SQL_STMT current;//当前步骤用的语句
+        MYSQL_BIND param[2];//参数直接指向job里的用户名和密码
+        MYSQL_BIND result[1];
+        unsigned long nameLen;
+        unsigned long pwdLen;
+        unsigned long passwordLen;
+        char password[PASSWORD_LEN];
+        int64_t stepDeadline;//当前步骤的期限，单位ms
+        int64_t libDeadline;//客户端库要求等待超时(MYSQL_WAIT_TIMEOUT)时的到期时间，0代表没有
+        Job job;
+    };
+
+    //把排队的任务分给空闲的连接
+    void Dispatch_();
+    //开始用type对应的语句执行，语句还没有prepare时先prepare
+    bool Begin_(AsyncConn& conn, SqlConnPool::SQL_STMT type);
+    //推进连接上的任务，event是套接字上发生的事件(MYSQL_WAIT_*)，刚开始一个步骤时为0
+    void Advance_(AsyncConn& conn, int event);
+    //步骤结束，根据结果决定下一步，返回false代表任务已经结束
+    bool NextStep_(AsyncConn& conn);
+    //任务结束，调用回调并让连接空闲
+    void Finish_(AsyncConn& conn, bool ok);
+    //关掉旧连接，准备非阻塞的重连，失败返回false
+    bool Reconnect_(AsyncConn& conn);
+    //等待的事件注册到事件后端
+    void Arm_(AsyncConn& conn, int status);
+    void Unregister_(AsyncConn& conn);
+    //关掉连接和上面的语句
+    void CloseConn_(AsyncConn& conn);
+    static int64_t NowMs_() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool isOpen_;
+    Poller* poller_;
+    int wakeFd_;//工作线程提交任务后用来唤醒主线程
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+    int stepTimeoutMs_;//每一步的期限
+
+    std::vector<AsyncConn> conns_;
+    std::unordered_map<int, int> fdMap_;//套接字到conns_下标的映射，只有主线程访问
+    std::deque<Job> jobQue_;//等待处理的任务
+    std::mutex mtx_;//保护jobQue_
+
+private:
+    static AsyncSql* asyncptr;
+};
+
+#endif //ASYNCSQL_H
@@ -6,10 +6,28 @@ using namespace std;
 //生成数据库连接池的单例
 SqlConnPool* SqlConnPool::sqlpoolptr = new SqlConnPool;
 
+//预编译语句的sql，参数都通过绑定传入，不再拼接字符串
+const char* SqlConnPool::STMT_SQL[STMT_COUNT] = {
+    "SELECT password FROM user WHERE username=? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?,?)"
+};
+
 
 SqlConnPool::SqlConnPool() {
+    port_ = 0;
+    MIN_CONN_ = 0;
+    MAX_CONN_ = 0;
+    acquireTimeoutMs_ = 0;
+    idleTimeoutMs_ = 0;
+    checkIntervalMs_ = 0;
     useCount_ = 0;
     freeCount_ = 0;
+    totalCount_ = 0;
+    isClose_ = false;
+    for(int i = 0; i < WAIT_BUCKET_COUNT; ++i) {
+        waitHist_[i] = 0;
+    }
+    waitTotalUs_ = 0;
 }
 
 SqlConnPool* SqlConnPool::Instance() {
@@ -19,55 +37,293 @@ SqlConnPool* SqlConnPool::Instance() {
 //之所以不在构造时初始化，是因为这里用了单例模式，一开始就构造了一个，但是不知道这些参数，所以等后面再初始化
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10) {
+            int minConn, int maxConn, int acquireTimeoutMs,
+            int idleTimeoutMs, int checkIntervalMs) {
 
-    assert(connSize > 0);
-    for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);//初始化一个mysql结构
+    assert(minConn > 0 && maxConn >= minConn);
+    host_ = host;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
+    port_ = port;
+    MIN_CONN_ = minConn;
+    MAX_CONN_ = maxConn;
+    acquireTimeoutMs_ = acquireTimeoutMs;
+    idleTimeoutMs_ = idleTimeoutMs;
+    checkIntervalMs_ = checkIntervalMs;
+    for (int i = 0; i < minConn; i++) {
+        MYSQL *sql = Connect_();
         if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
+            //连不上的不放进队列，维护线程之后会补足
+            continue;
         }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);//真正连接到MYSQL数据库
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
+        connQue_.push_back({sql, chrono::steady_clock::now()});
+        ++totalCount_;
+    }
+    freeCount_ = connQue_.size();
+    LOG_INFO("SqlConnPool init, %d/%d connected, max %d", totalCount_, minConn, maxConn);
+    maintainThread_ = thread(&SqlConnPool::Maintain_, this);
+}
+
+MYSQL* SqlConnPool::Connect_() {
+    MYSQL *sql = mysql_init(nullptr);//初始化一个mysql结构
+    if (!sql) {
+        LOG_ERROR("MySql init error!");
+        return nullptr;
+    }
+    unsigned int timeout = 3;//数据库挂掉时不要让调用者阻塞太久
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+    if (!mysql_real_connect(sql, host_.c_str(),
+                            user_.c_str(), pwd_.c_str(),
+                            dbName_.c_str(), port_, nullptr, 0)) {//真正连接到MYSQL数据库
+        LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+        mysql_close(sql);
+        return nullptr;
+    }
+    return sql;
+}
+
+void SqlConnPool::Disconnect_(MYSQL* sql) {
+    {
+        //语句属于连接，要先于连接关闭，而且指针可能被新连接复用，缓存必须删掉
+        lock_guard<mutex> locker(mtx_);
+        auto it = stmtMap_.find(sql);
+        if(it != stmtMap_.end()) {
+            for(MYSQL_STMT* stmt : it->second) {
+                if(stmt) { mysql_stmt_close(stmt); }
+            }
+            stmtMap_.erase(it);
         }
-        connQue_.push(sql);
     }
-    MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    mysql_close(sql);
 }
 
 MYSQL* SqlConnPool::GetConn() {
     MYSQL *sql = nullptr;
-    sem_wait(&semId_);//从队列中拿一个，如果拿不到，就阻塞等待
-    if(connQue_.empty()){
-        LOG_WARN("sem_wait() fake post");
-        return nullptr;
+    auto start = chrono::steady_clock::now();
+    auto deadline = start + chrono::milliseconds(acquireTimeoutMs_);
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        if(isClose_) {
+            return nullptr;
+        }
+        if(!connQue_.empty()) {//从尾部拿最近用过的连接
+            sql = connQue_.back().sql;
+            connQue_.pop_back();
+            break;
+        }
+        if(totalCount_ < MAX_CONN_) {//没有空闲连接但还没到上限，直接新建一个，不用等
+            ++totalCount_;
+            locker.unlock();
+            sql = Connect_();
+            locker.lock();
+            if(sql) {
+                LOG_INFO("SqlConnPool grow to %d", totalCount_);
+                break;
+            }
+            --totalCount_;
+        }
+        //到了上限就等别人放回，超时就放弃
+        if(cond_.wait_until(locker, deadline) == cv_status::timeout && connQue_.empty()) {
+            locker.unlock();
+            RecordWait_(chrono::steady_clock::now() - start, true);
+            LOG_WARN("SqlConnPool GetConn timeout!");
+            return nullptr;
+        }
     }
-    lock_guard<mutex> locker(mtx_);
-    sql = connQue_.front();
-    connQue_.pop();
-    
+    ++useCount_;
+    freeCount_ = connQue_.size();
+    locker.unlock();
+    RecordWait_(chrono::steady_clock::now() - start, false);
     return sql;
 }
 
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
     lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    sem_post(&semId_);
+    connQue_.push_back({sql, chrono::steady_clock::now()});
+    --useCount_;
+    freeCount_ = connQue_.size();
+    cond_.notify_one();
 }
 
-void SqlConnPool::ClosePool() {
+void SqlConnPool::RecordWait_(chrono::steady_clock::duration wait, bool timeout) {
+    long us = chrono::duration_cast<chrono::microseconds>(wait).count();
+    waitTotalUs_ += us;
+    if(timeout) { ++waitHist_[WAIT_TIMEOUT]; }
+    else if(us < 100) { ++waitHist_[WAIT_100US]; }
+    else if(us < 1000) { ++waitHist_[WAIT_1MS]; }
+    else if(us < 10000) { ++waitHist_[WAIT_10MS]; }
+    else if(us < 100000) { ++waitHist_[WAIT_100MS]; }
+    else if(us < 1000000) { ++waitHist_[WAIT_1S]; }
+    else { ++waitHist_[WAIT_SLOW]; }
+}
+
+std::string SqlConnPool::GetStats() {
+    int total, use, free;
+    {
+        lock_guard<mutex> locker(mtx_);
+        total = totalCount_;
+        use = useCount_;
+        free = connQue_.size();
+    }
+    unsigned long count = 0;
+    for(int i = 0; i < WAIT_BUCKET_COUNT; ++i) {
+        count += waitHist_[i];
+    }
+    char stats[256];
+    snprintf(stats, sizeof(stats),
+             "sqlpool total:%d use:%d free:%d wait <100us:%lu <1ms:%lu <10ms:%lu <100ms:%lu <1s:%lu >=1s:%lu timeout:%lu avg:%luus",
+             total, use, free, waitHist_[WAIT_100US].load(), waitHist_[WAIT_1MS].load(), waitHist_[WAIT_10MS].load(),
+             waitHist_[WAIT_100MS].load(), waitHist_[WAIT_1S].load(), waitHist_[WAIT_SLOW].load(),
+             waitHist_[WAIT_TIMEOUT].load(), count ? waitTotalUs_.load() / count : 0);
+    return stats;
+}
+
+//维护线程，每隔一段时间做三件事：关掉空闲太久的连接，检查空闲连接是否还活着，补足最少连接数
+void SqlConnPool::Maintain_() {
+    unsigned long lastCount = 0;
+    unique_lock<mutex> locker(mtx_);
+    while(!isClose_) {
+        closeCond_.wait_for(locker, chrono::milliseconds(checkIntervalMs_));
+        if(isClose_) {
+            break;
+        }
+        auto now = chrono::steady_clock::now();
+        //1.收缩，头部是空闲最久的
+        vector<MYSQL*> idle;
+        while(!connQue_.empty() && totalCount_ > MIN_CONN_ &&
+              now - connQue_.front().lastUsed > chrono::milliseconds(idleTimeoutMs_)) {
+            idle.push_back(connQue_.front().sql);
+            connQue_.pop_front();
+            --totalCount_;
+        }
+        locker.unlock();
+        for(MYSQL* sql : idle) {
+            Disconnect_(sql);
+        }
+        if(!idle.empty()) {
+            LOG_INFO("SqlConnPool shrink %d idle connections", (int)idle.size());
+        }
+        locker.lock();
+
+        //2.健康检查，只查上一轮之后没被用过的连接，一次只拿出一个，其余的连接照常可以被取走
+        //mysql_ping会有网络往返，不能拿着锁做；取用都在尾部，头部的下标不会因此移动
+        size_t i = 0;
+        while(!isClose_ && i < connQue_.size() &&
+              now - connQue_[i].lastUsed > chrono::milliseconds(checkIntervalMs_)) {
+            IdleConn conn = connQue_[i];
+            connQue_.erase(connQue_.begin() + i);
+            locker.unlock();
+            if(mysql_ping(conn.sql) != 0) {
+                LOG_WARN("MySql ping error: %s, reconnect", mysql_error(conn.sql));
+                Disconnect_(conn.sql);
+                conn.sql = Connect_();//重连失败就少一个连接，之后再补
+            }
+            locker.lock();
+            if(!conn.sql) {
+                --totalCount_;
+                continue;
+            }
+            //放回原来的位置，不影响下次收缩的判断
+            if(i > connQue_.size()) {
+                i = connQue_.size();
+            }
+            connQue_.insert(connQue_.begin() + i, conn);
+            cond_.notify_one();
+            ++i;
+        }
+        //3.补足最少连接数
+        while(!isClose_ && totalCount_ < MIN_CONN_) {
+            ++totalCount_;
+            locker.unlock();
+            MYSQL* sql = Connect_();
+            locker.lock();
+            if(!sql) {
+                --totalCount_;
+                break;
+            }
+            connQue_.push_front({sql, chrono::steady_clock::now()});
+            cond_.notify_one();
+        }
+        freeCount_ = connQue_.size();
+
+        //有新的获取连接时，把统计信息写到日志中
+        unsigned long count = 0;
+        for(int i = 0; i < WAIT_BUCKET_COUNT; ++i) {
+            count += waitHist_[i];
+        }
+        if(count != lastCount) {
+            lastCount = count;
+            locker.unlock();
+            LOG_INFO("%s", GetStats().c_str());
+            locker.lock();
+        }
+    }
+}
+
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* sql, SQL_STMT type) {
+    assert(sql && type < STMT_COUNT);
+    std::vector<MYSQL_STMT*>* stmts;
+    {
+        //只在查找或插入时加锁，unordered_map的元素引用在插入后依然有效
+        lock_guard<mutex> locker(mtx_);
+        stmts = &stmtMap_[sql];
+    }
+    if(stmts->empty()) {
+        stmts->resize(STMT_COUNT, nullptr);
+    }
+    MYSQL_STMT*& stmt = (*stmts)[type];
+    if(stmt) {
+        return stmt;
+    }
+    //第一次使用，先在这个连接上prepare
+    stmt = mysql_stmt_init(sql);
+    if(!stmt) {
+        LOG_ERROR("mysql_stmt_init() error");
+        return nullptr;
+    }
+    if(mysql_stmt_prepare(stmt, STMT_SQL[type], strlen(STMT_SQL[type]))) {
+        LOG_ERROR("mysql_stmt_prepare() error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        stmt = nullptr;
+    }
+    return stmt;
+}
+
+void SqlConnPool::ResetStmt(MYSQL* sql, SQL_STMT type) {
+    assert(sql && type < STMT_COUNT);
     lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    auto it = stmtMap_.find(sql);
+    if(it == stmtMap_.end() || it->second.empty() || !it->second[type]) {
+        return;
+    }
+    mysql_stmt_close(it->second[type]);
+    it->second[type] = nullptr;
+}
+
+void SqlConnPool::ClosePool() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClose_) {
+            return;
+        }
+        isClose_ = true;
+        closeCond_.notify_all();
+        cond_.notify_all();
+    }
+    if(maintainThread_.joinable()) {
+        maintainThread_.join();
+    }
+    deque<IdleConn> conns;
+    {
+        lock_guard<mutex> locker(mtx_);
+        conns.swap(connQue_);
+        totalCount_ -= conns.size();
+        freeCount_ = 0;
+    }
+    for(IdleConn& conn : conns) {
+        Disconnect_(conn.sql);
     }
     mysql_library_end();//连接关闭后还需要把整体资源释放掉，避免在使用库完成应用程序后发生内存泄漏
 }
@@ -3,51 +3,104 @@
 
 #include <mysql/mysql.h>//这是C的mysql库
 #include <string>
-#include <queue>
+#include <deque>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
 #include <thread>
+#include <vector>
+#include <unordered_map>
 
 #include "../log/log.h"
 
 
-//数据库连接池，初始化时先创建好mysql的多个连接，放入队列
+//数据库连接池，初始化时先创建好最少数量的mysql连接，放入队列
 //有要使用的就从队列中拿，释放时再放回队列中
+//没有空闲连接时，只要没到最大连接数，就直接新建一个，到了上限才等待，等待有超时时间，超时返回nullptr
+//后台的维护线程定期对空闲连接mysql_ping，断开的就重连，空闲太久的连接在多于最少数量时关掉
+//每次获取连接的等待时间都记录在直方图中
 //数据连接池还有一个真正释放连接的函数
 
 class SqlConnPool {
 public:
+    //每个连接上缓存的预编译语句种类，第一次用到时才prepare，之后在连接的整个生命周期内复用
+    enum SQL_STMT { STMT_LOGIN = 0, STMT_REGISTER, STMT_COUNT };
+    static const char* STMT_SQL[STMT_COUNT];//每种语句对应的sql，参数用?占位，异步数据库也用这些语句
+    //等待时间直方图的桶，上界分别是100us,1ms,10ms,100ms,1s,超过1s,最后一个是超时没拿到的次数
+    enum WAIT_BUCKET { WAIT_100US = 0, WAIT_1MS, WAIT_10MS, WAIT_100MS, WAIT_1S, WAIT_SLOW, WAIT_TIMEOUT, WAIT_BUCKET_COUNT };
+
     static SqlConnPool* Instance();
 
-    //从队列中获取一个数据库连接
+    //从队列中获取一个数据库连接，等待超过超时时间返回nullptr
     MYSQL *GetConn();
     //使用完连接后放回队列
     void FreeConn(MYSQL * conn);
     //获取队列中剩余的未使用连接数量
     int GetFreeConnCount();
     //产生mysql连接的函数并放入队列
-    //主机名，MYSQL的端口号，用户名，密码，数据库名，mysql连接数量
+    //主机名，MYSQL的端口号，用户名，密码，数据库名，最少连接数量，最多连接数量，获取连接的超时时间(ms)
+    //空闲超过idleTimeoutMs的连接会被关掉，维护线程每隔checkIntervalMs检查一次
     void Init(const char* host, int port,
               const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* dbName, int minConn, int maxConn,
+              int acquireTimeoutMs, int idleTimeoutMs = 60000, int checkIntervalMs = 5000);
     //释放掉队列中所有的连接
     void ClosePool();
+    //获取连接上对应的预编译语句，没有就先prepare再缓存，失败返回nullptr
+    MYSQL_STMT* GetStmt(MYSQL* sql, SQL_STMT type);
+    //语句执行出错时把缓存的语句关掉，下次使用时会重新prepare
+    void ResetStmt(MYSQL* sql, SQL_STMT type);
+    //连接池的统计信息：连接数和等待时间直方图
+    std::string GetStats();
 
 private:
     SqlConnPool();
     ~SqlConnPool();
 
+    //空闲的连接，以及放回池中的时间
+    struct IdleConn {
+        MYSQL* sql;
+        std::chrono::steady_clock::time_point lastUsed;
+    };
+
+    //新建一个mysql连接，失败返回nullptr
+    MYSQL* Connect_();
+    //关闭连接，连带关闭连接上的预编译语句
+    void Disconnect_(MYSQL* sql);
+    //维护线程：健康检查，收缩空闲连接，补足最少连接
+    void Maintain_();
+    void RecordWait_(std::chrono::steady_clock::duration wait, bool timeout);
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+
+    int MIN_CONN_;//最少连接数
     int MAX_CONN_;//最大连接数
-    int useCount_;//当前连接数
+    int acquireTimeoutMs_;//获取连接的超时时间
+    int idleTimeoutMs_;//空闲连接的最长保留时间
+    int checkIntervalMs_;//维护线程的检查间隔
+    int useCount_;//当前被取出使用的连接数
     int freeCount_;//剩余连接数
+    int totalCount_;//总连接数，包括正在新建和正在健康检查的
 
-    std::queue<MYSQL *> connQue_;//队列，用于保存mysql指针，这个指针是MYSQL库中的，用于操作mysql数据库
+    std::deque<IdleConn> connQue_;//空闲连接，从尾部取放，头部就是空闲最久的
     std::mutex mtx_;//互斥锁
-    sem_t semId_;//信号量
+    std::condition_variable cond_;//没有空闲连接又到了上限时在这里等待
+
+    std::atomic<unsigned long> waitHist_[WAIT_BUCKET_COUNT];//获取连接等待时间的直方图
+    std::atomic<unsigned long> waitTotalUs_;//总的等待时间，单位us
+
+    bool isClose_;
+    std::thread maintainThread_;
+    std::condition_variable closeCond_;//关闭时唤醒维护线程
+
+    //每个连接对应的预编译语句，下标就是SQL_STMT，连接被取出后只有持有者会使用自己的语句
+    std::unordered_map<MYSQL*, std::vector<MYSQL_STMT*>> stmtMap_;
 
 private:
     static SqlConnPool* sqlpoolptr;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -8,93 +8,135 @@
 #define THREADPOLL_H
 
 #include <pthread.h>
+#include <stdio.h>
 #include <list>
+#include <string>
 #include <exception>
 #include <iostream>
-#include <unordered_map>
+#include <atomic>
+#include <chrono>
 #include "../locker/locker.h"
 #include "../log/log.h"
+#include "../affinity/affinity.h"
 
 
 //定义为模板类，T为线程需要执行的任务类，这样本次虽然任务类是解析HTTP，但可以添加其他任务类以完成其他任务
+//线程数在最少和最多之间伸缩：数据库慢时工作线程都阻塞在查询上，后面的任务排队时间变长，就逐个加线程；
+//线程长时间闲着时再逐个退掉，平时不会一直占着比核数多得多的线程
+//积压的任务已经在别的线程的队列里了，所以线程自己的队列空了以后会去别的队列偷任务
+//伸缩只由主线程的周期任务调用Adjust决定，放任务也只在主线程，所以哪些队列在用不需要加锁
 template<typename T>
 class ThreadPool{
 
 public:
-    ThreadPool(int thread_number = 6 ,int  max_requests = 10000);
+    //pin为true时第i个线程绑在CpuAffinity给的第i个工作CPU上，为false时不绑单个CPU
+    ThreadPool(int thread_number = 6 ,int  max_requests = 10000, int max_threads = 0, bool pin = true);
     ~ThreadPool();
-    bool Append(T* request);
+    //prefer是希望放入的请求队列，-1或者那个队列满了时按轮询放
+    bool Append(T* request, int prefer = -1);
+    //所有请求队列中还没开始处理的任务数，主线程用来做准入控制
+    int Pending() const { return m_pending.load(std::memory_order_relaxed); }
+    //任务在队列中等待时间的滑动平均，单位us
+    int WaitUs() const { return m_wait_us.load(std::memory_order_relaxed); }
+    int Threads() const { return m_active; }
+
+    //伸缩的策略：有积压并且排队时间的滑动平均超过growWaitUs时加一个线程，
+    //连续idleMs没有积压并且至少有一个线程闲着时退掉一个线程，两个条件之间留有空档，不会来回抖动
+    void SetPolicy(int growWaitUs, int idleMs);
+    //有多个线程池时用来在日志中区分
+    void SetName(const std::string& name) { m_name = name; }
+    //主线程周期调用，periodMs是调用的周期
+    void Adjust(int periodMs);
+    //线程数、伸缩次数和排队情况，写日志用
+    std::string GetStats();
 
 private:
     static void* Worker(void* arg);//静态函数，只能访问静态成员
-    void Run();
-
+    void Run(int number);
+    bool Grow_();
+    void Retire_();
+    void Reap_();//回收已经退出的线程，之后这个位置可以再用
 
 private:
-    //线程池中的线程数量
-    int m_thread_number;
-    //线程池数组，动态创建，大小为m_thread_number
-    pthread_t * m_threads;
-    //请求队列数组,为每一个线程都生成一个请求队列
-    std::list<T*>* m_workqueues;
+    //队列中的任务，带着入队的时间，用来统计排队的时间
+    struct Job{
+        T* request;
+        std::chrono::steady_clock::time_point enqueue;
+    };
+    enum SLOT_STATE { SLOT_IDLE = 0, SLOT_RUNNING, SLOT_EXITED };
+    //每个线程一个请求队列和一个信号量，平时把线程阻塞，对应的任务队列中有任务时把线程唤醒
+    //线程的序号创建时直接传进去，不再让线程自己去查
+    struct Slot{
+        ThreadPool* pool;
+        int index;
+        pthread_t thread;
+        std::list<Job> queue;
+        Locker lock;//主线程放、工作线程取，队列要加锁
+        Sem sem;
+        std::atomic<int> state;
+        std::atomic<bool> retire;//被退掉的线程处理完自己队列中剩下的任务后退出
+    };
+    //从自己的队列取任务，自己的取完了再从别的队列偷一个，新加的线程靠它分担已经积压的任务
+    bool Take_(int number, Job& job);
+
+    //最少的线程数，这些线程一直在
+    int m_min_threads;
+    //最多的线程数
+    int m_max_threads;
+    //正在用的线程数，下标小于它的队列才会放入任务，只在主线程修改
+    int m_active;
+    //线程的位置，按最多的线程数分配
+    Slot* m_slots;
     //每一个请求队列中允许的最大请求数
     int m_max_requests;
-    // //保护请求队列的互斥锁
-    // locker m_queuelocker;
-    //每一个请求队列都对应一个信号量，平时把线程阻塞，对应的任务队列中有任务时把线程唤醒
-    Sem* m_queuestats;
 
-    //是否结束线程，因为所有线程都共用一个线程池，所以m_stop=true会结束所有准备开始下一轮的线程
-    bool m_stop;
+    //是否结束线程，所有线程都会在准备开始下一轮时结束
+    std::atomic<bool> m_stop;
 
     //用于轮询，知道该放入第几个线程的请求队列中
     int m_number;
-    //一个哈希表，需要告诉每个线程自己的id号对应的是第几个线程
-    std::unordered_map<pthread_t,int> hash;
 
+    std::atomic<int> m_pending;//还在队列中的任务数
+    std::atomic<int> m_wait_us;//排队时间的滑动平均，每个新样本占1/8
+    std::atomic<int> m_busy;//正在执行任务的线程数
+
+    int m_grow_wait_us;
+    int m_idle_ms;
+    int m_idle_for;//连续有线程闲着的时间，单位ms
+    int m_grows;
+    int m_shrinks;
+    std::string m_name;
+    bool m_pin;
 };
 
 //构造函数
 template<typename T>
-ThreadPool<T>::ThreadPool(int thread_number ,int  max_requests):
-    m_thread_number(thread_number),m_threads(nullptr),m_workqueues(nullptr)
-    ,m_max_requests(max_requests),m_queuestats(nullptr),m_stop(false),m_number(0){
+ThreadPool<T>::ThreadPool(int thread_number ,int  max_requests, int max_threads, bool pin):
+    m_min_threads(thread_number),m_max_threads(max_threads < thread_number ? thread_number : max_threads),
+    m_active(0),m_slots(nullptr),m_max_requests(max_requests),m_stop(false),m_number(0),
+    m_pending(0),m_wait_us(0),m_busy(0),m_grow_wait_us(10000),m_idle_ms(10000),m_idle_for(0),m_grows(0),m_shrinks(0),m_name("ThreadPool"),m_pin(pin){
 
     if((thread_number<=0) || (max_requests<=0)){
         LOG_ERROR("thread_number<=0 || max_requests<=0");
         throw std::exception();
     }
     //这些必须先创建，因为第一个线程创建后就会去使用，没有就会出现段错误
-    //为每一个线程创建请求队列
-    m_workqueues = new std::list<T*>[m_thread_number];
-    //每个请求队列一个信号量
-    m_queuestats = new Sem[m_thread_number];
-
-    //创建线程数组
-    m_threads= new pthread_t[m_thread_number];
-
-    if(!m_threads){
-        LOG_ERROR("new pthread_t[] error");
-        throw std::exception();
+    m_slots = new Slot[m_max_threads];
+    for(int i=0;i<m_max_threads;++i){
+        m_slots[i].pool = this;
+        m_slots[i].index = i;
+        m_slots[i].state = SLOT_IDLE;
+        m_slots[i].retire = false;
     }
 
-    //创建m_thread_number个线程,并设置为线程脱离，并告诉线程tid对应的序号放在哈希表中
-    for(int i=0;i<m_thread_number;++i){
+    //先创建最少的线程数，析构时要等它们退出后才能释放队列，所以不设置线程脱离
+    for(int i=0;i<m_min_threads;++i){
         std::cout<<"create the "<<i<<"th thread"<<std::endl;
-        if(pthread_create(m_threads+i,NULL,Worker,this)!=0){//worker是子线程执行的代码，在C++中必须是静态的
+        if(!Grow_()){
             LOG_ERROR("pthread_create() error");
-            delete[] m_threads;
             throw std::exception();
         }
-        if(pthread_detach(m_threads[i])!=0){
-            LOG_ERROR("pthread_detach() error");
-            delete[] m_threads;
-            throw std::exception();
-        }
-        hash.insert(std::pair<pthread_t,int>(m_threads[i],i));
     }
-
-    
 }
 
 
@@ -102,66 +144,213 @@ ThreadPool<T>::ThreadPool(int thread_number ,int  max_requests):
 template<typename T>
 ThreadPool<T>::~ThreadPool(){
     m_stop = true;
-    //析构的时候设置了true，但是阻塞状态根本没办法结束，所以需要全部唤醒
-    for(int i=0;i<m_thread_number;++i){
-        m_queuestats[i].Post();
-    }
-    
-    delete [] m_workqueues;
-    delete [] m_queuestats;
-    delete [] m_threads;
+    //阻塞在信号量上的线程看不到m_stop，需要全部唤醒，再等它们结束
+    for(int i=0;i<m_max_threads;++i){
+        if(m_slots[i].state != SLOT_IDLE){
+            m_slots[i].sem.Post();
+            pthread_join(m_slots[i].thread,nullptr);
+        }
+    }
+    delete [] m_slots;
 }
 
 //把任务指针加入队列，轮询放入
 template<typename T>
-bool ThreadPool<T>::Append(T* request){
+bool ThreadPool<T>::Append(T* request, int prefer){
+    Job job;
+    job.request = request;
+    job.enqueue = std::chrono::steady_clock::now();
+    //按收包的CPU指定了同一节点上的线程，就不参与轮询
+    if(prefer >= 0 && prefer < m_active){
+        Slot& slot = m_slots[prefer];
+        slot.lock.Lock();
+        if(slot.queue.size() < (size_t)m_max_requests){
+            slot.queue.push_back(job);
+            slot.lock.unLock();
+            m_pending.fetch_add(1, std::memory_order_relaxed);
+            slot.sem.Post();
+            return true;
+        }
+        slot.lock.unLock();
+    }
+    if(m_number>=m_active){//线程被退掉后轮询的位置可能超出范围
+        m_number=0;
+    }
     int start = m_number;
-    while(m_workqueues[m_number].size()>=m_max_requests){//先找一个不满的请求队列
+    while(1){//先找一个不满的请求队列
+        Slot& slot = m_slots[m_number];
         ++m_number;
-        if(m_number>=m_thread_number){
+        if(m_number>=m_active){
             m_number=0;
         }
+        slot.lock.Lock();
+        if(slot.queue.size() < (size_t)m_max_requests){
+            slot.queue.push_back(job);
+            slot.lock.unLock();
+            m_pending.fetch_add(1, std::memory_order_relaxed);
+            slot.sem.Post();
+            return true;
+        }
+        slot.lock.unLock();
         if(m_number==start){//如果再次回到原地，就放弃
             return false;
         }
     }
-    m_workqueues[m_number].push_back(request);
-    m_queuestats[m_number].Post();
-    ++m_number;
-    if(m_number>=m_thread_number){
-        m_number=0;
-    }
+}
 
+template<typename T>
+void ThreadPool<T>::SetPolicy(int growWaitUs, int idleMs){
+    m_grow_wait_us = growWaitUs;
+    m_idle_ms = idleMs;
+}
 
+template<typename T>
+void ThreadPool<T>::Adjust(int periodMs){
+    Reap_();
+    int pending = Pending();
+    //排队时间只在取任务时更新，没有积压时不看它，免得一次高峰后一直加线程
+    if(pending > 0 && WaitUs() >= m_grow_wait_us){
+        m_idle_for = 0;
+        if(m_active < m_max_threads && Grow_()){
+            ++m_grows;
+            LOG_INFO("%s grow, %s", m_name.c_str(), GetStats().c_str());
+        }
+        return;
+    }
+    if(pending == 0 && m_busy.load(std::memory_order_relaxed) < m_active){
+        m_idle_for += periodMs;
+    }else{
+        m_idle_for = 0;
+    }
+    if(m_idle_for >= m_idle_ms && m_active > m_min_threads){
+        m_idle_for = 0;
+        Retire_();
+        ++m_shrinks;
+        LOG_INFO("%s shrink, %s", m_name.c_str(), GetStats().c_str());
+    }
+}
+
+template<typename T>
+bool ThreadPool<T>::Grow_(){
+    Slot& slot = m_slots[m_active];
+    if(slot.state != SLOT_IDLE){
+        return false;//这个位置的线程被退掉后还在处理剩下的任务，下一次再加
+    }
+    slot.retire = false;
+    slot.state = SLOT_RUNNING;
+    //worker是子线程执行的代码，在C++中必须是静态的
+    if(pthread_create(&slot.thread,NULL,Worker,&slot)!=0){
+        slot.state = SLOT_IDLE;
+        return false;
+    }
+    ++m_active;
+    //唤醒一次，让新线程马上去别的队列偷积压的任务
+    slot.sem.Post();
     return true;
 }
 
+template<typename T>
+void ThreadPool<T>::Retire_(){
+    //总是退掉最后一个，主线程之后就不再往它的队列里放任务
+    --m_active;
+    Slot& slot = m_slots[m_active];
+    slot.retire = true;
+    slot.sem.Post();
+}
+
+template<typename T>
+void ThreadPool<T>::Reap_(){
+    for(int i=m_active;i<m_max_threads;++i){
+        if(m_slots[i].state == SLOT_EXITED){
+            pthread_join(m_slots[i].thread,nullptr);
+            m_slots[i].state = SLOT_IDLE;
+        }
+    }
+}
+
+template<typename T>
+std::string ThreadPool<T>::GetStats(){
+    char buf[256];
+    snprintf(buf,sizeof(buf),"threads %d (%d-%d), busy %d, pending %d, wait %dus, grows %d, shrinks %d",
+             m_active,m_min_threads,m_max_threads,m_busy.load(std::memory_order_relaxed),Pending(),WaitUs(),m_grows,m_shrinks);
+    return buf;
+}
+
 //worker是子线程要运行的程序，但由于不能访问非静态成员，是因为没有this指针。
-//所以把this当作变量进行传递，就可以在worker中调用this中的非静态成员了
+//所以把线程的位置当作变量进行传递，位置里有线程池的指针和线程的序号
 template<typename T>
 void* ThreadPool<T>::Worker(void* arg){
-    ThreadPool * pool = (ThreadPool*)arg;
-    pool->Run();
-    return pool;
+    Slot* slot = (Slot*)arg;
+    slot->pool->Run(slot->index);
+    slot->state = SLOT_EXITED;
+    return slot;
+}
+
+template<typename T>
+bool ThreadPool<T>::Take_(int number, Job& job){
+    Slot& slot = m_slots[number];
+    slot.lock.Lock();
+    if(!slot.queue.empty()){
+        job = slot.queue.front();
+        slot.queue.pop_front();
+        slot.lock.unLock();
+        return true;
+    }
+    slot.lock.unLock();
+    //被退掉的线程只处理自己剩下的任务；没有积压时不用挨个看别的队列
+    if(slot.retire || Pending() == 0){
+        return false;
+    }
+    //偷来的任务在原来的信号量上多了一次唤醒，那个线程醒来发现队列是空的会接着等，不影响正确性
+    for(int i=1;i<m_max_threads;++i){
+        Slot& other = m_slots[(number + i) % m_max_threads];
+        if(other.state != SLOT_RUNNING){
+            continue;
+        }
+        other.lock.Lock();
+        if(!other.queue.empty()){
+            job = other.queue.front();
+            other.queue.pop_front();
+            other.lock.unLock();
+            return true;
+        }
+        other.lock.unLock();
+    }
+    return false;
 }
 
 //run函数就是循环的从工作队列中取任务并执行
 template<typename T>
-void ThreadPool<T>::Run(){
-    int number=hash[pthread_self()];
+void ThreadPool<T>::Run(int number){
+    if(m_pin){
+        CpuAffinity::Instance()->PinWorker(number);
+    }else{
+        CpuAffinity::Instance()->PinFloating();
+    }
+    Slot& slot = m_slots[number];
     while(!m_stop){
-        m_queuestats[number].Wait();//要从线程对应的工作队列中取,就要用对应的信号量
-        if(m_workqueues[number].empty()){//其实就一个线程对应一个队列，如果要析构，唤醒后是可能为空的，continue后再次判断就能停下来
+        Job job;
+        if(!Take_(number, job)){
+            //要析构或者被退掉时，队列空了才退出，队列中剩下的任务不会丢
+            if(slot.retire){
+                break;
+            }
+            slot.sem.Wait();//没有任务可做时阻塞，对应的工作队列中放入任务时会被唤醒
             continue;
         }
-        T* request = m_workqueues[number].front();
-        m_workqueues[number].pop_front();
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        int waited = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job.enqueue).count();
+        int avg = m_wait_us.load(std::memory_order_relaxed);
+        m_wait_us.store(avg + (waited - avg) / 8, std::memory_order_relaxed);
+        T* request = job.request;
         if(!request){//如果为空，就再跳过
             continue;
         }
+        m_busy.fetch_add(1, std::memory_order_relaxed);
         request->Process();//线程去执行任务中的process类，任务类中一定要有这个函数
+        m_busy.fetch_sub(1, std::memory_order_relaxed);
     }
 
 }
 
-#endif
\ No newline at end of file
+#endif
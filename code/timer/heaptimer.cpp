@@ -3,12 +3,11 @@
 //上滤操作
 void HeapTimer::Siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
+    while(i > 0) {//i是size_t，到了堆顶就要停下，否则(i-1)/2会越界
+        size_t j = (i - 1) / 2;
         if(heap_[j] <= heap_[i]) { break; }
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -37,14 +36,14 @@ bool HeapTimer::Siftdown_(size_t index, size_t n) {
 }
 
 
-void HeapTimer::Add(int id, int timeout, void (*TimeoutCallback)(Http_Conn*,int) ) {
+void HeapTimer::Add(int id, int timeout, void (*TimeoutCallback)(Http_Conn::Hot*,int) ) {
     assert(id >= 0);
     size_t i;
     if(ref_.count(id) == 0) {
         /* 新节点：堆尾插入，调整堆 */
         i = heap_.size();
         ref_[id] = i;
-        heap_.push_back({id,false, std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(timeout), TimeoutCallback});
+        heap_.push_back({id,false, std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(timeout), TimeoutCallback, 0});
         Siftup_(i);
     } 
     else {
@@ -59,7 +58,16 @@ void HeapTimer::Add(int id, int timeout, void (*TimeoutCallback)(Http_Conn*,int)
     }
 }
 
-void HeapTimer::DoWork(Http_Conn* user,int id) {
+void HeapTimer::AddPeriodic(int id, int period, void (*TimeoutCallback)(Http_Conn::Hot*,int) ) {
+    assert(id < 0 && period > 0);
+    assert(ref_.count(id) == 0);
+    size_t i = heap_.size();
+    ref_[id] = i;
+    heap_.push_back({id,false, std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(period), TimeoutCallback, period});
+    Siftup_(i);
+}
+
+void HeapTimer::DoWork(Http_Conn::Hot* user,int id) {
     /* 删除指定id结点，并触发回调函数 */
     if(heap_.empty() || ref_.count(id) == 0) {
         return;
@@ -102,7 +110,7 @@ void HeapTimer::Adjust(int id, int timeout) {
     Siftdown_(ref_[id], heap_.size());
 } 
 
-void HeapTimer::Tick(Http_Conn* user,int timeout) {
+void HeapTimer::Tick(Http_Conn::Hot* user,int timeout) {
     /* 清除超时结点 */
     if(heap_.empty()) {
         return;
@@ -124,6 +132,10 @@ void HeapTimer::Tick(Http_Conn* user,int timeout) {
         }
 
         node.TimeoutCallback(user,node.id);
+        if(node.period > 0){//周期任务执行完不删除，而是延后一个周期
+            Adjust(node.id,node.period);
+            continue;
+        }
         Pop();
     }
 }
@@ -139,7 +151,7 @@ void HeapTimer::Clear() {
 }
 
 
-int HeapTimer::GetNextTick(Http_Conn* user,int timeout) {
+int HeapTimer::GetNextTick(Http_Conn::Hot* user,int timeout) {
     Tick(user,timeout);//先处理超时的定时器
     size_t res = -1;
     if(!heap_.empty()) {
@@ -152,8 +164,11 @@ int HeapTimer::GetNextTick(Http_Conn* user,int timeout) {
 
 
 void HeapTimer::Happen(int fd){
-    int i = ref_[fd];//先得到发生事件的定时器的位置
-    heap_[i].isHappened = true;//标志改为1
+    std::unordered_map<int, size_t>::iterator it = ref_.find(fd);//先得到发生事件的定时器的位置
+    if(it == ref_.end()){
+        return;
+    }
+    heap_[it->second].isHappened = true;//标志改为1
 
 }
 
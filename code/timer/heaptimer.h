@@ -16,7 +16,8 @@ struct TimerNode {
     int id;//定时器对应的套接字
     bool isHappened;//用于标注定时器在当前时间段是否发生过事件
     std::chrono::high_resolution_clock::time_point expires;//高精度时间
-    void (*TimeoutCallback)(Http_Conn*,int);
+    void (*TimeoutCallback)(Http_Conn::Hot*,int);
+    int period;//周期任务的周期，单位ms，0代表是套接字的定时器，超时后就删除
     //TimeoutCallBack cb;
     bool operator<(const TimerNode& t) {
         return expires < t.expires;
@@ -35,17 +36,20 @@ public:
     
     void Adjust(int id, int newExpires);
 
-    void Add(int id, int timeOut, void (*TimeoutCallback)(Http_Conn*,int) );
+    void Add(int id, int timeOut, void (*TimeoutCallback)(Http_Conn::Hot*,int) );
 
-    void DoWork(Http_Conn* user,int id);
+    //添加周期任务，每隔period毫秒调用一次回调，id必须是负数，以免和套接字冲突
+    void AddPeriodic(int id, int period, void (*TimeoutCallback)(Http_Conn::Hot*,int) );
+
+    void DoWork(Http_Conn::Hot* user,int id);
 
     void Clear();
 
-    void Tick(Http_Conn* user,int timeout);
+    void Tick(Http_Conn::Hot* user,int timeout);
 
     void Pop();
 
-    int GetNextTick(Http_Conn* user,int timeout);
+    int GetNextTick(Http_Conn::Hot* user,int timeout);
 
     void Happen(int fd);
 
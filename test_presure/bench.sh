@@ -0,0 +1,57 @@
+#!/bin/sh
+# 对比模拟Proactor和Reactor两种事件处理模式
+# 在临时目录里用同一个可执行文件分别按两种模式启动，按不同的响应大小和并发连接数用webbench压测，最后输出一张表
+# 需要先make编译好服务器和webbench，数据库要和平时运行一样配置好
+#
+# 用法：./bench.sh [端口] [每轮秒数]
+# 环境变量：SIZES 响应大小(KB)，CONNS 并发连接数，PAUSE 每轮之间等待的秒数(让TIME_WAIT的连接释放)，BIN 服务器的路径
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$DIR")
+PORT=${1:-9090}
+TIME=${2:-5}
+SIZES=${SIZES:-"1 16 256"}
+CONNS=${CONNS:-"50 200 1000"}
+PAUSE=${PAUSE:-30}
+BIN=${BIN:-$ROOT/bin/webserver}
+WEBBENCH=$DIR/webbench-1.5/webbench
+
+if [ ! -x "$BIN" ] || [ ! -x "$WEBBENCH" ]; then
+    echo "先编译服务器($BIN)和webbench($WEBBENCH)"
+    exit 1
+fi
+
+#服务器的资源、配置和日志都在工作目录下，放在临时目录里不影响正在用的文件
+WORK=$(mktemp -d)
+trap 'kill $PID 2>/dev/null; rm -rf "$WORK"' EXIT
+cp -r "$ROOT/resources" "$WORK/resources"
+mkdir -p "$WORK/filedir"
+for size in $SIZES; do
+    head -c $((size * 1024)) /dev/zero | tr '\0' 'a' > "$WORK/resources/bench_${size}k.html"
+done
+
+printf "%-9s %8s %6s %14s %8s\n" mode size conns pages/min failed
+for mode in proactor reactor; do
+    cp "$ROOT/webserver.conf" "$WORK/webserver.conf"
+    #限速和准入控制会拒绝压测的连接，日志只记警告以上
+    printf "event_mode = %s\nrate_ip_per_sec = 0\nrate_global_per_sec = 0\nlog_level = 2\n" $mode >> "$WORK/webserver.conf"
+    (cd "$WORK" && exec "$BIN" $PORT > "$WORK/server.txt" 2>&1) &
+    PID=$!
+    sleep 2
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "服务器启动失败："
+        cat "$WORK/server.txt"
+        exit 1
+    fi
+    for size in $SIZES; do
+        for conns in $CONNS; do
+            out=$("$WEBBENCH" -c $conns -t $TIME -2 "http://127.0.0.1:$PORT/bench_${size}k.html" 2>/dev/null)
+            speed=$(echo "$out" | sed -n 's/^Speed=\([0-9]*\) pages\/min.*/\1/p')
+            failed=$(echo "$out" | sed -n 's/^Requests: [0-9]* susceed, \([0-9]*\) failed.*/\1/p')
+            printf "%-9s %7sK %6s %14s %8s\n" $mode $size $conns "${speed:--}" "${failed:--}"
+            sleep $PAUSE
+        done
+    done
+    kill $PID
+    wait $PID 2>/dev/null
+done
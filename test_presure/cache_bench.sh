@@ -0,0 +1,84 @@
+#!/bin/sh
+# 测量每个请求的缓存缺失：先建立一批空闲的长连接，再用webbench压活跃连接，同时用perf stat统计服务器进程的L1和LLC缺失
+# 给了BASE时用同样的负载再测一遍BASE，用来对比热数据表拆分前后的两个版本
+# 需要先make编译好服务器和webbench，并且装了perf，数据库要和平时运行一样配置好
+# 空闲连接很多时要先调大文件描述符上限，比如ulimit -n 200000
+#
+# 用法：./cache_bench.sh [端口] [秒数]
+# 环境变量：IDLE 空闲连接数，ACTIVE webbench的并发数，BIN 服务器的路径，BASE 对比用的服务器的路径
+
+DIR=$(cd "$(dirname "$0")" && pwd)
+ROOT=$(dirname "$DIR")
+PORT=${1:-9090}
+TIME=${2:-10}
+IDLE=${IDLE:-50000}
+ACTIVE=${ACTIVE:-5000}
+BIN=${BIN:-$ROOT/bin/webserver}
+BASE=${BASE:-}
+WEBBENCH=$DIR/webbench-1.5/webbench
+EVENTS=L1-dcache-load-misses,LLC-load-misses,instructions
+
+if [ ! -x "$BIN" ] || [ ! -x "$WEBBENCH" ]; then
+    echo "先编译服务器($BIN)和webbench($WEBBENCH)"
+    exit 1
+fi
+if ! command -v perf > /dev/null; then
+    echo "需要perf"
+    exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'kill $PID $HOLDER 2>/dev/null; rm -rf "$WORK"' EXIT
+cp -r "$ROOT/resources" "$WORK/resources"
+mkdir -p "$WORK/filedir"
+
+#空闲连接发一个请求后一直不关，服务器的热数据表里就有IDLE个在用的位置
+cat > "$WORK/idle.py" <<'EOF'
+import socket, sys, time
+port, count = int(sys.argv[1]), int(sys.argv[2])
+conns = []
+for i in range(count):
+    s = socket.create_connection(("127.0.0.1", port))
+    s.sendall(b"GET / HTTP/1.1\r\nHost: x\r\nConnection: keep-alive\r\n\r\n")
+    conns.append(s)
+print("ready", flush=True)
+time.sleep(1000000)
+EOF
+
+printf "%-40s %14s %12s %12s %12s\n" binary pages L1-miss/req LLC-miss/req insn/req
+for bin in $BIN $BASE; do
+    cp "$ROOT/webserver.conf" "$WORK/webserver.conf"
+    #空闲连接不能被超时关掉，限速也不能拒绝压测的连接
+    printf "overtime_ms = 600000\nrate_ip_per_sec = 0\nrate_global_per_sec = 0\nlog_level = 2\n" >> "$WORK/webserver.conf"
+    (cd "$WORK" && exec "$bin" $PORT > "$WORK/server.txt" 2>&1) &
+    PID=$!
+    sleep 2
+    if ! kill -0 $PID 2>/dev/null; then
+        echo "服务器启动失败："
+        cat "$WORK/server.txt"
+        exit 1
+    fi
+    python3 "$WORK/idle.py" $PORT $IDLE > "$WORK/idle.txt" 2>&1 &
+    HOLDER=$!
+    while ! grep -q ready "$WORK/idle.txt" 2>/dev/null; do
+        if ! kill -0 $HOLDER 2>/dev/null; then
+            echo "建立空闲连接失败："
+            cat "$WORK/idle.txt"
+            exit 1
+        fi
+        sleep 1
+    done
+    perf stat -x, -e $EVENTS -p $PID -o "$WORK/perf.txt" -- sleep $TIME &
+    PERF=$!
+    out=$("$WEBBENCH" -c $ACTIVE -t $TIME -2 "http://127.0.0.1:$PORT/" 2>/dev/null)
+    wait $PERF
+    pages=$(echo "$out" | sed -n 's/^Requests: \([0-9]*\) susceed.*/\1/p')
+    pages=${pages:-0}
+    l1=$(grep L1-dcache-load-misses "$WORK/perf.txt" | cut -d, -f1)
+    llc=$(grep LLC-load-misses "$WORK/perf.txt" | cut -d, -f1)
+    insn=$(grep instructions "$WORK/perf.txt" | cut -d, -f1)
+    printf "%-40s %14s %12s %12s %12s\n" "$(basename $(dirname $bin))/$(basename $bin)" $pages \
+        $(awk -v a="$l1" -v b="$llc" -v c="$insn" -v n=$pages 'BEGIN{ if(n==0){ print "- - -" } else { printf "%.0f %.1f %.0f", a/n, b/n, c/n } }')
+    kill $HOLDER $PID
+    wait $PID 2>/dev/null
+done